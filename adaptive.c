@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "adaptive.h"
+#include "common.h" // For now_ts, diff_ts
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+void adapt_init(adapt_t *a, double tol)
+{
+    memset(a, 0, sizeof *a);
+    a->tol = tol;
+}
+
+static double mean_of(const double *v, int n)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += v[i];
+    return sum / n;
+}
+
+int adapt_update(adapt_t *a, double elapsed, uint64_t bytes)
+{
+    double dt = elapsed - a->last_t;
+    if (dt <= 0)
+        return 0;
+    double rate = (bytes - a->last_bytes) / dt;
+    a->last_bytes = bytes;
+    a->last_t = elapsed;
+    if (elapsed < ADAPT_WARMUP_S)
+        return 0;
+
+    a->rates[a->n++ % ADAPT_WINDOW] = rate;
+    if (a->n < ADAPT_WINDOW)
+        return 0;
+
+    // Oldest first, so the halves are the older and the newer second
+    double w[ADAPT_WINDOW];
+    for (int i = 0; i < ADAPT_WINDOW; i++)
+        w[i] = a->rates[(a->n + i) % ADAPT_WINDOW];
+    double mean = mean_of(w, ADAPT_WINDOW);
+    if (mean <= 0)
+        return 0;
+    double var = 0;
+    for (int i = 0; i < ADAPT_WINDOW; i++)
+        var += (w[i] - mean) * (w[i] - mean);
+    double half_width = ADAPT_Z * sqrt(var / (ADAPT_WINDOW - 1)) / sqrt(ADAPT_WINDOW);
+    double drift = fabs(mean_of(w + ADAPT_WINDOW / 2, ADAPT_WINDOW / 2) - mean_of(w, ADAPT_WINDOW / 2));
+
+    if (half_width > a->tol * mean || drift > a->tol * mean)
+        return 0;
+    a->mean = mean;
+    return 1;
+}
+
+double adapt_watch(double tol, double cap_s, adapt_sample_fn sample, void *ctx, int *stop)
+{
+    adapt_t a;
+    adapt_init(&a, tol);
+    struct timespec start = now_ts(), next = start, now = start;
+    double elapsed = 0;
+
+    while (elapsed < cap_s)
+    {
+        next.tv_nsec += ADAPT_INTERVAL_MS * 1000000L;
+        if (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        uint64_t bytes = 0;
+        int running = sample(ctx, &bytes);
+        now = now_ts();
+        elapsed = diff_ts(&start, &now);
+        if (running == 0)
+            return elapsed;
+        if (adapt_update(&a, elapsed, bytes))
+        {
+            printf("client: rate converged at %.2f Mb/s (within %.1f%%) after %.1f s\n", a.mean * 8 / 1e6,
+                   tol * 100, elapsed);
+            break;
+        }
+    }
+    __atomic_store_n(stop, 1, __ATOMIC_RELEASE);
+    return elapsed;
+}
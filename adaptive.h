@@ -0,0 +1,56 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdint.h>
+
+#define ADAPT_INTERVAL_MS 100 // rate samples of the whole phase
+#define ADAPT_WINDOW 20       // samples judged together (2 s)
+#define ADAPT_WARMUP_S 1.0    // slow start is never part of the window
+#define ADAPT_Z 1.96          // 95% confidence
+
+/**
+ * @brief Decides when the aggregate rate of a phase has converged.
+ *
+ * Over the last ADAPT_WINDOW intervals the phase has converged when the
+ * 95% confidence half-width of the mean rate is within tol of it, and the
+ * two halves of the window agree within tol too (a rate still ramping up
+ * can look steady interval by interval).
+ */
+typedef struct adapt
+{
+    double tol;               // relative bound, e.g. 0.05
+    double rates[ADAPT_WINDOW]; // bytes/s, ring
+    int n;                    // samples taken
+    uint64_t last_bytes;
+    double last_t;
+    double mean;              // of the window, once it converged
+} adapt_t;
+
+void adapt_init(adapt_t *a, double tol);
+
+/**
+ * @brief Feeds the bytes moved so far by every stream of the phase.
+ *
+ * @param elapsed Seconds since the phase started.
+ * @return int 1 once the rate has converged, 0 otherwise.
+ */
+int adapt_update(adapt_t *a, double elapsed, uint64_t bytes);
+
+/**
+ * @brief Reads the phase: bytes moved so far by its streams.
+ *
+ * @return int Streams still running; 0 ends the watch.
+ */
+typedef int (*adapt_sample_fn)(void *ctx, uint64_t *bytes);
+
+/**
+ * @brief Samples the phase every ADAPT_INTERVAL_MS until its rate converges
+ *        or cap_s seconds go by, then sets *stop for its streams.
+ *
+ * Returns early, without setting *stop, if every stream ended by itself.
+ *
+ * @return double Seconds watched.
+ */
+double adapt_watch(double tol, double cap_s, adapt_sample_fn sample, void *ctx, int *stop);
+
+#endif // ADAPTIVE_H
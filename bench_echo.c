@@ -0,0 +1,131 @@
+// Microbenchmark: paquetes por segundo del eco UDP en loopback, de a uno y en lotes
+// Uso: make bench && ./bench_echo [segundos] [hilos_cliente]
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "common.h"
+#include "latency.h"
+#include "results_table.h"
+
+#define BENCH_PORT 20351 // + 1 por cada tamaño de lote probado
+#define BENCH_WINDOW 32  // pedidos en vuelo por hilo cliente
+#define BENCH_DEFAULT_SECONDS 3
+#define BENCH_DEFAULT_CLIENTS 4
+
+typedef struct bench_client
+{
+    int port;
+    int seconds;
+    uint64_t echoes;
+} bench_client_t;
+
+// Mantiene BENCH_WINDOW ecos en vuelo; los perdidos se reenvían tras 50 ms
+static void *bench_client(void *arg)
+{
+    bench_client_t *c = arg;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in srv = {.sin_family = AF_INET, .sin_port = htons(c->port)};
+    inet_pton(AF_INET, "127.0.0.1", &srv.sin_addr);
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 50000};
+    if (fd < 0 || connect(fd, (struct sockaddr *)&srv, sizeof srv) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) < 0)
+    {
+        perror("bench client socket");
+        return NULL;
+    }
+
+    uint8_t payload[LAT_PAYLOAD_SIZE] = {0xff, 1, 2, 3};
+    uint8_t bufs[BENCH_WINDOW][LAT_MAX_REQUEST];
+    struct iovec out_iov = {.iov_base = payload, .iov_len = sizeof payload};
+    struct iovec in_iov[BENCH_WINDOW];
+    struct mmsghdr out[BENCH_WINDOW], in[BENCH_WINDOW];
+    memset(out, 0, sizeof out);
+    memset(in, 0, sizeof in);
+    for (int i = 0; i < BENCH_WINDOW; i++)
+    {
+        out[i].msg_hdr.msg_iov = &out_iov;
+        out[i].msg_hdr.msg_iovlen = 1;
+        in_iov[i].iov_base = bufs[i];
+        in_iov[i].iov_len = sizeof bufs[i];
+        in[i].msg_hdr.msg_iov = &in_iov[i];
+        in[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    struct timespec start = now_ts(), now = start;
+    while (diff_ts(&start, &now) < c->seconds)
+    {
+        int sent = sendmmsg(fd, out, BENCH_WINDOW, 0);
+        for (int got = 0; sent > 0 && got < sent;)
+        {
+            int n = recvmmsg(fd, in, sent - got, MSG_WAITFORONE, NULL);
+            if (n <= 0)
+                break; // timeout: el resto se perdió
+            got += n;
+            c->echoes += n;
+        }
+        now = now_ts();
+    }
+    close(fd);
+    return NULL;
+}
+
+static double run(int batch, int port, int seconds, int n_clients, results_table_t *results)
+{
+    echo_server_args_t *a = calloc(1, sizeof *a); // el hilo de eco lo usa hasta el final
+    if (!a)
+        die("calloc");
+    a->results = results;
+    a->port = port;
+    a->batch = batch;
+
+    pthread_t server;
+    if (pthread_create(&server, NULL, latency_echo_server, a) != 0)
+        die("pthread_create (echo)");
+    pthread_detach(server); // no termina: el proceso sale al final
+    usleep(100000);
+
+    pthread_t tids[n_clients];
+    bench_client_t clients[n_clients];
+    uint64_t total = 0;
+    for (int i = 0; i < n_clients; i++)
+    {
+        clients[i] = (bench_client_t){.port = port, .seconds = seconds};
+        pthread_create(&tids[i], NULL, bench_client, &clients[i]);
+    }
+    for (int i = 0; i < n_clients; i++)
+    {
+        pthread_join(tids[i], NULL);
+        total += clients[i].echoes;
+    }
+    return (double)total / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_SECONDS;
+    int n_clients = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_CLIENTS;
+    if (seconds <= 0)
+        seconds = BENCH_DEFAULT_SECONDS;
+    if (n_clients <= 0)
+        n_clients = BENCH_DEFAULT_CLIENTS;
+
+    results_table_t results;
+    if (rt_init(&results, 1, RT_DEFAULT_TTL) < 0)
+        return 1;
+
+    printf("%d s per run, %d client threads, %d echoes in flight each\n", seconds, n_clients, BENCH_WINDOW);
+    const int batches[] = {1, LAT_BATCH};
+    for (int i = 0; i < 2; i++)
+    {
+        double pps = run(batches[i], BENCH_PORT + i, seconds, n_clients, &results);
+        printf("batch %2d: %10.0f echoes/s\n", batches[i], pps);
+    }
+    return 0;
+}
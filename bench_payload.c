@@ -0,0 +1,58 @@
+// Microbenchmark: generación del payload aleatorio, por implementación
+// Uso: make bench && ./bench_payload [MB]
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "payload.h"
+
+#define BENCH_DEFAULT_MB 256
+#define BENCH_ROUNDS 5
+
+int main(int argc, char *argv[])
+{
+    long mb = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_MB;
+    if (mb <= 0)
+        mb = BENCH_DEFAULT_MB;
+    size_t len = (size_t)mb << 20;
+    uint8_t *buf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    memset(buf, 0, len); // fault the pages in outside the timing
+
+    int best = payload_rng_best();
+    printf("%ld MB, best of %d rounds (CPU supports up to %s)\n", mb, BENCH_ROUNDS, payload_rng_name(best));
+
+    struct timespec t0 = now_ts();
+    memset(buf, 'A', len);
+    struct timespec t1 = now_ts();
+    printf("%-7s %8.2f GB/s\n", "memset", len / diff_ts(&t0, &t1) / 1e9);
+
+    for (int rng = PAYLOAD_RNG_SCALAR; rng <= best; rng++)
+    {
+        double best_s = 0;
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+        {
+            t0 = now_ts();
+            payload_fill_random(buf, len, 42 + r, rng);
+            t1 = now_ts();
+            double s = diff_ts(&t0, &t1);
+            if (r == 0 || s < best_s)
+                best_s = s;
+        }
+        // Sanity: no run of 'A's or zeros survives a fill
+        size_t same = 0;
+        for (size_t i = 1; i < len; i++)
+            same += buf[i] == buf[i - 1];
+        printf("%-7s %8.2f GB/s  %.4f%% repeated bytes\n", payload_rng_name(rng), len / best_s / 1e9,
+               100.0 * same / len);
+    }
+    munmap(buf, len);
+    return 0;
+}
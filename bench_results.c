@@ -0,0 +1,82 @@
+// Microbenchmark: empaquetado/desempaquetado de resultados, texto vs binario
+// Uso: make bench && ./bench_results [iteraciones]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "handle_result.h"
+
+#define BENCH_BUF 8192
+#define BENCH_DEFAULT_ITERS 1000000
+
+typedef int (*pack_fn)(const struct BW_result *r, void *buf, int size);
+typedef int (*unpack_fn)(struct BW_result *r, const void *buf, int size);
+
+static int pack_text(const struct BW_result *r, void *buf, int size)
+{
+    return packResultPayload(*r, buf, size);
+}
+
+static int unpack_text(struct BW_result *r, const void *buf, int size)
+{
+    return unpackResultPayload(r, (void *)buf, size);
+}
+
+static int pack_binary(const struct BW_result *r, void *buf, int size)
+{
+    return packResultBinary(r, RESULT_FMT_BIN_V1, 0, buf, size);
+}
+
+static int unpack_binary(struct BW_result *r, const void *buf, int size)
+{
+    int first, kind;
+    return unpackResultBinary(r, buf, size, &first, &kind);
+}
+
+static void run(const char *name, pack_fn pack, unpack_fn unpack, const struct BW_result *in, long iters)
+{
+    static char buf[BENCH_BUF];
+    struct BW_result out;
+    int len = 0;
+    initBwResult(&out, in->n_conn);
+
+    struct timespec t0 = now_ts();
+    for (long i = 0; i < iters; i++)
+        len = pack(in, buf, sizeof(buf));
+    struct timespec t1 = now_ts();
+    for (long i = 0; i < iters; i++)
+        unpack(&out, buf, len);
+    struct timespec t2 = now_ts();
+
+    int ok = out.id_measurement == in->id_measurement;
+    for (int c = 0; c < NUM_CONN; c++)
+        ok = ok && out.conn_bytes[c] == in->conn_bytes[c];
+    freeBwResult(&out);
+
+    printf("%-7s %5d bytes  pack %8.1f ns/op  unpack %8.1f ns/op  %s\n", name, len,
+           diff_ts(&t0, &t1) * 1e9 / iters, diff_ts(&t1, &t2) * 1e9 / iters, ok ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char *argv[])
+{
+    long iters = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_ITERS;
+    if (iters <= 0)
+        iters = BENCH_DEFAULT_ITERS;
+
+    // Valores realistas: ~10 GB por conexión en ~10 s
+    struct BW_result in;
+    if (initBwResult(&in, NUM_CONN) < 0)
+        return 1;
+    in.id_measurement = 0xdeadbeef;
+    for (int c = 0; c < NUM_CONN; c++)
+    {
+        in.conn_bytes[c] = 10000000000ULL + 123457ULL * c;
+        in.conn_duration[c] = 10.0 + 0.001 * c;
+    }
+
+    printf("%ld iterations, %d connections\n", iters, NUM_CONN);
+    run("text", pack_text, unpack_text, &in, iters);
+    run("binary", pack_binary, unpack_binary, &in, iters);
+    freeBwResult(&in);
+    return 0;
+}
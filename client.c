@@ -13,18 +13,33 @@
 #include "latency.h"
 #include "upload.h"
 #include "handle_result.h" // For struct BW_result and packResultPayload
+#include "zerocopy.h"      // For ZC_MODE_*, zc_init
+#include "payload.h"       // For payload_init
+#include "discard.h"       // For DISCARD_*
+#include "adaptive.h"      // For adapt_watch
+#include "ramp.h"          // For ramp_run, ramp_result_t
 
 struct thr_arg
 {
     const char *host;
+    int recv_mode;
     uint64_t bytes;
+    ts_ring_t series; // bytes per TS_INTERVAL_MS of this stream
+    tcp_summary_t tcp; // TCP_INFO samples of this stream
+    const int *stop;   // adaptive mode: set when the phase has converged
+    const uint8_t *header; // DOWNLOAD_HEADER_LEN bytes naming the test, or NULL
+    int done;
 };
 
 struct latency_arg
 {
     const char *host;
-    double *rtts;
-    int num_measurements;
+    const char *phase; // for the logs
+    int rate_hz;
+    int flags; // LAT_PROBE_KERNEL_TS
+    double duration;
+    const int *stop; // set when the phase ends, if before duration
+    lat_probe_result_t probes;
     int completed;
 };
 
@@ -38,19 +53,51 @@ struct test_results
     double avg_bw_download_bps;
     double upload_elapsed;
     double avg_bw_upload_bps;
-    int num_conns;
+    int num_conns; // download streams
+    int num_conns_upload;
+    const ramp_result_t *ramp_download; // saturation curves, NULL without -R
+    const ramp_result_t *ramp_upload;
+    double adapt_tol; // 0: fixed T_SECONDS phases
     double rtt_idle;
     double rtt_download;
     double rtt_upload;
+    double loss_idle; // fraction of latency probes without reply
+    double loss_download;
+    double loss_upload;
+    const lat_hist_t *hist_idle; // full RTT distributions, for the percentiles
+    const lat_hist_t *hist_download;
+    const lat_hist_t *hist_upload;
+    int kernel_ts; // the rtt_kernel_* and rtt_gap_* below are valid
+    double rtt_kernel_idle; // averages between kernel timestamps
+    double rtt_kernel_download;
+    double rtt_kernel_upload;
+    double rtt_gap_idle; // user-space RTT - kernel RTT, averages
+    double rtt_gap_download;
+    double rtt_gap_upload;
+    const owd_result_t *owd_idle; // one-way delays, NULL or !valid if the server does not stamp
+    const owd_result_t *owd_download;
+    const owd_result_t *owd_upload;
+    const tcp_summary_t *tcp_download; // all streams merged; NULL if not sampled
+    const tcp_summary_t *tcp_upload;
+    const tcp_summary_t *tcp_download_streams; // num_conns of them; NULL if not sampled
+    const tcp_summary_t *tcp_upload_streams;   // num_conns_upload
+    const struct BW_tcp *tcp_download_server;  // the sender's side, from the results reply; NULL if not sent
+    int interval_ms;              // of both series
+    const double *download_series; // bps per interval, all streams together
+    int download_intervals;
+    const double *upload_series;
+    int upload_intervals;
 };
 
 static void *recv_thread(void *vp)
 {
     struct thr_arg *arg = vp;
 
-    int result = client_perform_download(arg->host, TCP_PORT_DOWN, T_SECONDS, &arg->bytes);
+    int result = client_perform_download(arg->host, TCP_PORT_DOWN, T_SECONDS, &arg->bytes, arg->recv_mode, &arg->series,
+                                         &arg->tcp, arg->stop, arg->header);
     if (result != DOWNLOAD_OK)
         fprintf(stderr, "Error in download thread: %d\n", result);
+    __atomic_store_n(&arg->done, 1, __ATOMIC_RELEASE);
 
     return NULL;
 }
@@ -59,27 +106,211 @@ static void *latency_thread(void *vp)
 {
     struct latency_arg *arg = vp;
 
-    printf("client: starting latency measurements during download...\n");
+    printf("client: probing latency at %d Hz during %s...\n", arg->rate_hz, arg->phase);
 
-    int result = client_measure_latency(arg->host, arg->num_measurements, 10, arg->rtts);
-    if (result != LAT_OK)
+    int result = client_probe_latency(arg->host, arg->rate_hz, arg->duration, arg->flags, arg->stop, &arg->probes);
+    if (result != LAT_OK || arg->probes.received == 0)
     {
-        fprintf(stderr, "Error in latency measurements: %d\n", result);
+        fprintf(stderr, "Error in latency measurements during %s: %d (%llu probes, no reply)\n", arg->phase,
+                result, (unsigned long long)arg->probes.sent);
         arg->completed = 0;
     }
     else
     {
         arg->completed = 1;
-        printf("client: completed %d latency measurements\n", arg->num_measurements);
+        printf("client: %llu of %llu latency probes answered during %s\n",
+               (unsigned long long)arg->probes.received, (unsigned long long)arg->probes.sent, arg->phase);
     }
 
     return NULL;
 }
 
+// Percentiles reported for every RTT distribution
+static const double rtt_percentiles[] = {0.5, 0.9, 0.99, 0.999};
+static const char *const rtt_percentile_names[] = {"p50", "p90", "p99", "p99_9"};
+#define N_PERCENTILES (sizeof rtt_percentiles / sizeof rtt_percentiles[0])
+
+#define JSON_MAX_DATAGRAM 65507 // the JSON goes in one UDP datagram over IPv4
+
+static void print_percentiles(const char *what, const lat_hist_t *h)
+{
+    printf("%s percentiles:", what);
+    for (size_t i = 0; i < N_PERCENTILES; i++)
+        printf(" %s %.3f ms", rtt_percentile_names[i], hist_percentile(h, rtt_percentiles[i]) / 1e6);
+    printf("\n");
+}
+
+static void print_latency(const char *what, const lat_probe_result_t *p)
+{
+    printf("\nLatency measurements %s:\n", what);
+    printf("Min RTT: %.3f ms\n", p->min * 1000);
+    printf("Max RTT: %.3f ms\n", p->max * 1000);
+    printf("Avg RTT: %.3f ms\n", p->avg * 1000);
+    print_percentiles("RTT", &p->hist);
+    if (p->kernel_ts)
+    {
+        printf("Kernel RTT: avg %.3f ms over %llu probes\n", hist_mean(&p->kernel_hist) / 1e6,
+               (unsigned long long)p->kernel_hist.count);
+        print_percentiles("Kernel RTT", &p->kernel_hist);
+        printf("User-space overhead: avg %.3f ms, p99 %.3f ms, max %.3f ms\n", hist_mean(&p->gap_hist) / 1e6,
+               hist_percentile(&p->gap_hist, 0.99) / 1e6, p->gap_hist.max_ns / 1e6);
+    }
+    if (p->owd.valid)
+    {
+        const owd_result_t *o = &p->owd;
+        printf("One-way delay up:   avg %.3f ms, p50 %.3f ms, p99 %.3f ms, jitter %.3f ms\n", hist_mean(&o->up) / 1e6,
+               hist_percentile(&o->up, 0.5) / 1e6, hist_percentile(&o->up, 0.99) / 1e6, o->jitter_up_ns / 1e6);
+        printf("One-way delay down: avg %.3f ms, p50 %.3f ms, p99 %.3f ms, jitter %.3f ms\n",
+               hist_mean(&o->down) / 1e6, hist_percentile(&o->down, 0.5) / 1e6,
+               hist_percentile(&o->down, 0.99) / 1e6, o->jitter_down_ns / 1e6);
+        printf("Clock offset (server - client): %.3f ms, skew %.1f ppm\n", o->offset_ns / 1e6, o->skew_ppm);
+    }
+    printf("Probes: %llu sent, %llu answered, loss %.2f%%, %llu reordered, %llu duplicated\n",
+           (unsigned long long)p->sent, (unsigned long long)p->received, lat_probe_loss(p) * 100,
+           (unsigned long long)p->reordered, (unsigned long long)p->duplicates);
+}
+
+// Suma las series de todas las conexiones en bps por intervalo (desde el
+// inicio de cada conexión, que arrancan juntas); devuelve cuántos intervalos
+static int aggregate_series(const struct BW_series *series, int n_conn, int interval_ms, double *bps)
+{
+    int n = 0;
+    memset(bps, 0, TS_SLOTS * sizeof(*bps));
+    for (int c = 0; c < n_conn; c++)
+    {
+        for (uint32_t i = 0; i < series[c].count && series[c].first + i < TS_SLOTS; i++)
+            bps[series[c].first + i] += series[c].bytes[i] * 8.0 * 1000 / interval_ms;
+        if (series[c].count && (int)(series[c].first + series[c].count) > n)
+            n = series[c].first + series[c].count;
+    }
+    return n < TS_SLOTS ? n : TS_SLOTS;
+}
+
+// Una línea por conexión con sus Mb/s en cada intervalo
+static void print_series(const char *what, const struct BW_series *series, int n_conn, int interval_ms)
+{
+    printf("%s: per-stream throughput every %d ms (Mb/s)\n", what, interval_ms);
+    for (int c = 0; c < n_conn; c++)
+    {
+        printf("  conn %d from interval %u:", c + 1, series[c].first);
+        for (uint32_t i = 0; i < series[c].count; i++)
+            printf(" %.1f", series[c].bytes[i] * 8.0 / 1000 / interval_ms);
+        printf("\n");
+    }
+}
+
+// Imprime el TCP_INFO de cada stream y deja en total el de todos juntos
+static void print_tcp(const char *what, const tcp_summary_t *tcp, int n_conn, tcp_summary_t *total)
+{
+    char label[64];
+    printf("%s: TCP_INFO per stream, min/avg/max\n", what);
+    tcpi_init(total);
+    for (int c = 0; c < n_conn; c++)
+    {
+        snprintf(label, sizeof label, "  conn %d", c + 1);
+        tcpi_print(&tcp[c], label);
+        tcpi_merge(total, &tcp[c]);
+    }
+    snprintf(label, sizeof label, "  all %d streams", n_conn);
+    tcpi_print(total, label);
+}
+
+// Agrega "name": [v, ...] a json
+static int append_series_json(char *json, size_t size, int len, const char *name, const double *bps, int n)
+{
+    if ((size_t)len >= size)
+        return len;
+    len += snprintf(json + len, size - len, ",\"%s\": [", name);
+    for (int i = 0; i < n && (size_t)len < size; i++)
+        len += snprintf(json + len, size - len, i ? ",%.0f" : "%.0f", bps[i]);
+    if ((size_t)len < size)
+        len += snprintf(json + len, size - len, "]");
+    return len;
+}
+
+// Agrega "rtt_<phase>_percentiles": {"p50": s, ...} en segundos
+static int append_percentiles_json(char *json, size_t size, int len, const char *phase, const lat_hist_t *h)
+{
+    if ((size_t)len >= size)
+        return len;
+    len += snprintf(json + len, size - len, ",\"rtt_%s_percentiles\": {", phase);
+    for (size_t i = 0; i < N_PERCENTILES && (size_t)len < size; i++)
+        len += snprintf(json + len, size - len, "%s\"%s\": %.6f", i ? "," : "", rtt_percentile_names[i],
+                        h ? hist_percentile(h, rtt_percentiles[i]) / 1e9 : 0.0);
+    if ((size_t)len < size)
+        len += snprintf(json + len, size - len, "}");
+    return len;
+}
+
+// Agrega "owd_<phase>": {...} en segundos, si el servidor selló las sondas
+static int append_owd_json(char *json, size_t size, int len, const char *phase, const owd_result_t *o)
+{
+    if (!o || !o->valid || (size_t)len >= size)
+        return len;
+    return len + snprintf(json + len, size - len,
+                          ",\"owd_%s\": {\"up\": %.6f,\"down\": %.6f,\"up_p99\": %.6f,\"down_p99\": %.6f,"
+                          "\"jitter_up\": %.6f,\"jitter_down\": %.6f,\"clock_offset\": %.6f,\"skew_ppm\": %.2f}",
+                          phase, hist_mean(&o->up) / 1e9, hist_mean(&o->down) / 1e9,
+                          hist_percentile(&o->up, 0.99) / 1e9, hist_percentile(&o->down, 0.99) / 1e9,
+                          o->jitter_up_ns / 1e9, o->jitter_down_ns / 1e9, o->offset_ns / 1e9, o->skew_ppm);
+}
+
+static int append_tcp_json(char *json, size_t size, int len, const char *name, const tcp_summary_t *tcp)
+{
+    if (!tcp || (size_t)len >= size)
+        return len;
+    len += snprintf(json + len, size - len, ",\"%s\": ", name);
+    if ((size_t)len < size)
+        len += tcpi_json(tcp, json + len, size - len);
+    return len;
+}
+
+// Agrega "<name>": [{...}, ...], el TCP_INFO de cada stream
+static int append_tcp_streams_json(char *json, size_t size, int len, const char *name, const tcp_summary_t *tcp,
+                                   int n)
+{
+    if (!tcp || (size_t)len >= size)
+        return len;
+    len += snprintf(json + len, size - len, ",\"%s\": [", name);
+    for (int i = 0; i < n && (size_t)len < size; i++)
+    {
+        if (i)
+            len += snprintf(json + len, size - len, ",");
+        if ((size_t)len < size)
+            len += tcpi_json(&tcp[i], json + len, size - len);
+    }
+    if ((size_t)len < size)
+        len += snprintf(json + len, size - len, "]");
+    return len;
+}
+
+// Agrega "<name>": [[streams, bps], ...], la curva de saturación de -R
+static int append_ramp_json(char *json, size_t size, int len, const char *name, const ramp_result_t *r)
+{
+    if (!r || (size_t)len >= size)
+        return len;
+    len += snprintf(json + len, size - len, ",\"%s\": [", name);
+    for (int i = 0; i < r->n_points && (size_t)len < size; i++)
+        len += snprintf(json + len, size - len, "%s[%d, %.0f]", i ? "," : "", r->points[i].streams,
+                        r->points[i].bps);
+    if ((size_t)len < size)
+        len += snprintf(json + len, size - len, "]");
+    return len;
+}
+
 int export_results_json(const struct test_results *results, const char *result_ip, int result_port)
 {
-    char json_buffer[1024];    // Buffer para el JSON
-    char timestamp_buffer[32]; // Buffer para el timestamp
+    // Escalares, percentiles, demoras de ida y TCP_INFO (también el del servidor) + las dos series
+    // (hasta 20 caracteres por valor) + las curvas de la rampa + el TCP_INFO de cada stream
+    size_t json_size = 3328 + 2 * TS_SLOTS * 24 + 2 * RAMP_MAX_STEPS * 32 +
+                       (size_t)(results->num_conns + results->num_conns_upload) * TCPI_JSON_MAX;
+    char *json_buffer = malloc(json_size); // Buffer para el JSON
+    char timestamp_buffer[32];             // Buffer para el timestamp
+    if (!json_buffer)
+    {
+        perror("malloc JSON");
+        return -1;
+    }
 
     // Obtener timestamp actual
     time_t rawtime;
@@ -89,7 +320,7 @@ int export_results_json(const struct test_results *results, const char *result_i
     strftime(timestamp_buffer, sizeof(timestamp_buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
 
     // Crear JSON en buffer
-    snprintf(json_buffer, sizeof(json_buffer),
+    int len = snprintf(json_buffer, json_size,
              "{"
              "\"src_ip\": \"%s\","
              "\"dst_ip\": \"%s\","
@@ -97,19 +328,78 @@ int export_results_json(const struct test_results *results, const char *result_i
              "\"avg_bw_download_bps\": %.0f,"
              "\"avg_bw_upload_bps\": %.0f,"
              "\"num_conns\": %d,"
-             "\"rtt_idle\": %.3f,"
-             "\"rtt_download\": %.3f,"
-             "\"rtt_upload\": %.3f"
-             "}",
+             "\"num_conns_upload\": %d,"
+             "\"adaptive_tol\": %.3f,"
+             "\"duration_download\": %.3f,"
+             "\"duration_upload\": %.3f,"
+             "\"rtt_idle\": %.6f,"
+             "\"rtt_download\": %.6f,"
+             "\"rtt_upload\": %.6f,"
+             "\"loss_idle\": %.4f,"
+             "\"loss_download\": %.4f,"
+             "\"loss_upload\": %.4f,"
+             "\"interval_ms\": %d",
              results->src_ip,
              results->dst_ip,
              timestamp_buffer,
              results->avg_bw_download_bps,
              results->avg_bw_upload_bps,
              results->num_conns,
+             results->num_conns_upload,
+             results->adapt_tol,
+             results->download_elapsed,
+             results->upload_elapsed,
              results->rtt_idle,
              results->rtt_download,
-             results->rtt_upload);
+             results->rtt_upload,
+             results->loss_idle,
+             results->loss_download,
+             results->loss_upload,
+             results->interval_ms);
+    len = append_percentiles_json(json_buffer, json_size, len, "idle", results->hist_idle);
+    len = append_percentiles_json(json_buffer, json_size, len, "download", results->hist_download);
+    len = append_percentiles_json(json_buffer, json_size, len, "upload", results->hist_upload);
+    if (results->kernel_ts && (size_t)len < json_size)
+        len += snprintf(json_buffer + len, json_size - len,
+                        ",\"rtt_kernel_idle\": %.6f,\"rtt_kernel_download\": %.6f,\"rtt_kernel_upload\": %.6f"
+                        ",\"rtt_gap_idle\": %.6f,\"rtt_gap_download\": %.6f,\"rtt_gap_upload\": %.6f",
+                        results->rtt_kernel_idle, results->rtt_kernel_download, results->rtt_kernel_upload,
+                        results->rtt_gap_idle, results->rtt_gap_download, results->rtt_gap_upload);
+    len = append_owd_json(json_buffer, json_size, len, "idle", results->owd_idle);
+    len = append_owd_json(json_buffer, json_size, len, "download", results->owd_download);
+    len = append_owd_json(json_buffer, json_size, len, "upload", results->owd_upload);
+    len = append_tcp_json(json_buffer, json_size, len, "tcp_download", results->tcp_download);
+    len = append_tcp_json(json_buffer, json_size, len, "tcp_upload", results->tcp_upload);
+    if (results->tcp_download_server && (size_t)len < json_size)
+    {
+        const struct BW_tcp *s = results->tcp_download_server;
+        len += snprintf(json_buffer + len, json_size - len,
+                        ",\"tcp_download_server\": {\"streams\": %u,\"retrans\": %u,\"busy\": %.6f,"
+                        "\"rwnd_limited\": %.6f,\"sndbuf_limited\": %.6f}",
+                        s->streams, s->retrans, s->busy_us / 1e6, s->rwnd_limited_us / 1e6,
+                        s->sndbuf_limited_us / 1e6);
+    }
+    len = append_ramp_json(json_buffer, json_size, len, "ramp_download", results->ramp_download);
+    len = append_ramp_json(json_buffer, json_size, len, "ramp_upload", results->ramp_upload);
+    len = append_series_json(json_buffer, json_size, len, "download_series_bps",
+                             results->download_series, results->download_intervals);
+    len = append_series_json(json_buffer, json_size, len, "upload_series_bps",
+                             results->upload_series, results->upload_intervals);
+    // Al final: si con muchos streams no caben en un datagrama, se omiten y se avisa
+    int before_streams = len;
+    len = append_tcp_streams_json(json_buffer, json_size, len, "tcp_download_streams",
+                                  results->tcp_download_streams, results->num_conns);
+    len = append_tcp_streams_json(json_buffer, json_size, len, "tcp_upload_streams",
+                                  results->tcp_upload_streams, results->num_conns_upload);
+    if (len + 1 > JSON_MAX_DATAGRAM)
+    {
+        fprintf(stderr, "client: per-stream TCP_INFO left out of the JSON: %d bytes do not fit a datagram\n",
+                len + 1);
+        len = before_streams + snprintf(json_buffer + before_streams, json_size - before_streams,
+                                        ",\"tcp_streams_omitted\": true");
+    }
+    if ((size_t)len < json_size)
+        snprintf(json_buffer + len, json_size - len, "}");
 
     // Crear socket UDP
     struct sockaddr_in result_addr;
@@ -117,6 +407,7 @@ int export_results_json(const struct test_results *results, const char *result_i
     if (sock < 0)
     {
         fprintf(stderr, "Error creating socket for JSON export\n");
+        free(json_buffer);
         return -1;
     }
 
@@ -126,6 +417,7 @@ int export_results_json(const struct test_results *results, const char *result_i
     {
         perror("sendto JSON");
         close(sock);
+        free(json_buffer);
         return -1;
     }
 
@@ -133,17 +425,94 @@ int export_results_json(const struct test_results *results, const char *result_i
     printf("JSON payload: %s\n", json_buffer);
 
     close(sock);
+    free(json_buffer);
     return 0;
 }
 
-int run_pipeline(const char *host, int num_connections, const char *result_ip, int result_port)
+struct download_watch
+{
+    struct thr_arg *args;
+    int n;
+};
+
+// Bytes recibidos por todos los streams de bajada; devuelve cuántos siguen
+static int download_sample(void *ctx, uint64_t *bytes)
+{
+    struct download_watch *w = ctx;
+    int running = 0;
+    *bytes = 0;
+    for (int i = 0; i < w->n; i++)
+    {
+        *bytes += __atomic_load_n(&w->args[i].bytes, __ATOMIC_RELAXED);
+        running += !__atomic_load_n(&w->args[i].done, __ATOMIC_ACQUIRE);
+    }
+    return running;
+}
+
+// Rampa de bajada: los streams se agregan de a uno hasta el elegido por ramp_run
+struct download_ramp
+{
+    struct download_watch watch; // n: streams lanzados
+    pthread_t *tids;
+    int recv_mode;
+    int stop;
+};
+
+static int download_ramp_start(void *ctx, int i)
+{
+    struct download_ramp *r = ctx;
+    struct thr_arg *arg = &r->watch.args[i];
+    arg->host = r->watch.args[0].host;
+    arg->recv_mode = r->recv_mode;
+    arg->stop = &r->stop;
+    if (pthread_create(&r->tids[i], NULL, recv_thread, arg) != 0)
+    {
+        perror("pthread_create (download ramp)");
+        return -1;
+    }
+    r->watch.n = i + 1;
+    return 0;
+}
+
+static int download_ramp_sample(void *ctx, uint64_t *bytes)
+{
+    struct download_ramp *r = ctx;
+    return download_sample(&r->watch, bytes);
+}
+
+// Busca cuántos streams de bajada saturan el camino; -1 si no hay memoria
+static int download_ramp(const char *host, int max_streams, int recv_mode, double threshold, ramp_result_t *out)
+{
+    struct download_ramp r = {.recv_mode = recv_mode};
+    r.watch.args = calloc(max_streams, sizeof(struct thr_arg));
+    r.tids = calloc(max_streams, sizeof(pthread_t));
+    if (!r.watch.args || !r.tids)
+    {
+        perror("calloc (download ramp)");
+        free(r.watch.args);
+        free(r.tids);
+        return -1;
+    }
+    r.watch.args[0].host = host;
+
+    printf("client: ramping download streams from %s:%s, up to %d...\n", host, TCP_PORT_DOWN, max_streams);
+    int chosen = ramp_run(max_streams, threshold, download_ramp_start, download_ramp_sample, &r, out);
+
+    __atomic_store_n(&r.stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < r.watch.n; i++)
+        pthread_join(r.tids[i], NULL);
+    free(r.watch.args);
+    free(r.tids);
+    return chosen;
+}
+
+int run_pipeline(const char *host, int num_connections, const char *result_ip, int result_port,
+                 int upload_send_mode, int download_recv_mode, int probe_hz, int probe_flags,
+                 double adapt_tol, double ramp_threshold, int per_stream)
 {
     // Variables for storing results
     uint64_t download_total_bytes = 0;
     double download_elapsed = 0;
-    double download_min_rtt = 0, download_max_rtt = 0, download_avg_rtt = 0;
-    double upload_min_rtt = 0, upload_max_rtt = 0, upload_avg_rtt = 0;
-    double idle_rtt = 0;
 
     // Get my own IP (a simple way, can be improved)
     char hostname[256];
@@ -159,42 +528,56 @@ int run_pipeline(const char *host, int num_connections, const char *result_ip, i
         }
     }
 
-    // === Initial latency measurements (idle) ===
-    printf("\n=== Measuring initial (idle) latency ===\n");
-    int num_latency_measurements = RTT_TRIES;
-    double *idle_rtts = calloc(num_latency_measurements, sizeof(double));
-
-    int result = client_measure_latency(host, num_latency_measurements, 10, idle_rtts);
-    if (result == LAT_OK)
+    // === Stream ramp-up: each direction finds its own saturation point ===
+    int download_conns = num_connections, upload_conns = num_connections;
+    ramp_result_t download_ramp_res, upload_ramp_res;
+    if (ramp_threshold > 0)
     {
-        // Calculate average of initial RTT measurements
-        idle_rtt = 0;
-        for (int i = 0; i < num_latency_measurements; i++)
+        printf("\n=== Ramping up DOWNLOAD streams ===\n");
+        download_conns = download_ramp(host, num_connections, download_recv_mode, ramp_threshold,
+                                       &download_ramp_res);
+        sleep(1);
+        printf("\n=== Ramping up UPLOAD streams ===\n");
+        upload_conns = upload_ramp(host, num_connections, upload_send_mode, ramp_threshold, &upload_ramp_res);
+        if (download_conns < 0 || upload_conns < 0)
         {
-            idle_rtt += idle_rtts[i];
+            fprintf(stderr, "Error in stream ramp-up\n");
+            return -1;
         }
-        idle_rtt /= num_latency_measurements;
-        printf("Idle RTT: %.3f ms\n", idle_rtt * 1000);
+        ramp_print(&download_ramp_res, "Download");
+        ramp_print(&upload_ramp_res, "Upload");
+        // Que las colas se vacíen antes de medir la latencia en reposo
+        sleep(2);
     }
-    else
+
+    // === Initial latency measurements (idle) ===
+    printf("\n=== Measuring initial (idle) latency ===\n");
+    struct latency_arg idle_lat_arg = {
+        .host = host, .phase = "idle", .rate_hz = probe_hz, .flags = probe_flags, .duration = IDLE_PROBE_SECONDS};
+    latency_thread(&idle_lat_arg);
+    if (!idle_lat_arg.completed)
     {
-        fprintf(stderr, "Error in initial latency measurements: %d\n", result);
-        free(idle_rtts);
+        fprintf(stderr, "Error in initial latency measurements\n");
         return -1;
     }
+    print_latency("while idle", &idle_lat_arg.probes);
 
     // === Download + Latency phase ===
     printf("\n=== Starting DOWNLOAD + latency test ===\n");
 
-    pthread_t *download_tids = calloc(num_connections, sizeof(pthread_t));
-    struct thr_arg *download_args = calloc(num_connections, sizeof(struct thr_arg));
+    pthread_t *download_tids = calloc(download_conns, sizeof(pthread_t));
+    struct thr_arg *download_args = calloc(download_conns, sizeof(struct thr_arg));
+    // One test id for both directions: the server reports its side of the
+    // download with the upload's results
+    uint8_t test_id[4];
+    new_test_id(test_id);
+    uint8_t (*download_headers)[DOWNLOAD_HEADER_LEN] = calloc(download_conns, DOWNLOAD_HEADER_LEN);
 
-    double *download_rtts = calloc(num_latency_measurements, sizeof(double));
+    // Las sondas terminan con la fase, aunque se corte antes de T_SECONDS
+    int download_stop = 0, download_ended = 0;
     struct latency_arg download_lat_arg = {
-        .host = host,
-        .rtts = download_rtts,
-        .num_measurements = num_latency_measurements,
-        .completed = 0};
+        .host = host, .phase = "download", .rate_hz = probe_hz, .flags = probe_flags, .duration = T_SECONDS,
+        .stop = &download_ended};
     pthread_t download_latency_tid;
 
     struct timespec t_start_download, t_end_download;
@@ -203,22 +586,36 @@ int run_pipeline(const char *host, int num_connections, const char *result_ip, i
     if (pthread_create(&download_latency_tid, NULL, latency_thread, &download_lat_arg) != 0)
         perror("pthread_create for download latency");
 
-    for (int i = 0; i < num_connections; ++i)
+    for (int i = 0; i < download_conns; ++i)
     {
         download_args[i].host = host;
+        download_args[i].recv_mode = download_recv_mode;
+        download_args[i].stop = adapt_tol > 0 ? &download_stop : NULL;
+        if (download_headers)
+        {
+            fill_header(download_headers[i], test_id, i);
+            download_args[i].header = download_headers[i];
+        }
         pthread_create(&download_tids[i], NULL, recv_thread, &download_args[i]);
     }
 
-    for (int i = 0; i < num_connections; ++i)
+    if (adapt_tol > 0)
+    {
+        struct download_watch watch = {.args = download_args, .n = download_conns};
+        adapt_watch(adapt_tol, T_SECONDS, download_sample, &watch, &download_stop);
+    }
+
+    for (int i = 0; i < download_conns; ++i)
     {
         pthread_join(download_tids[i], NULL);
         download_total_bytes += download_args[i].bytes;
     }
+    __atomic_store_n(&download_ended, 1, __ATOMIC_RELEASE);
+    // Before the probes' grace period: only the streams count
+    clock_gettime(CLOCK_MONOTONIC, &t_end_download);
 
     pthread_join(download_latency_tid, NULL);
 
-    clock_gettime(CLOCK_MONOTONIC, &t_end_download);
-
     download_elapsed = (t_end_download.tv_sec - t_start_download.tv_sec) +
                        (t_end_download.tv_nsec - t_start_download.tv_nsec) / 1e9;
 
@@ -229,33 +626,38 @@ int run_pipeline(const char *host, int num_connections, const char *result_ip, i
     printf("Download: throughput %.2f Mb/s\n", download_throughput / 1e6);
 
     if (download_lat_arg.completed)
-    {
-        download_min_rtt = download_rtts[0];
-        download_max_rtt = download_rtts[0];
-        download_avg_rtt = 0;
+        print_latency("during download", &download_lat_arg.probes);
 
-        for (int i = 0; i < num_latency_measurements; i++)
-        {
-            if (download_rtts[i] > 0)
-            {
-                if (download_rtts[i] < download_min_rtt)
-                    download_min_rtt = download_rtts[i];
-                if (download_rtts[i] > download_max_rtt)
-                    download_max_rtt = download_rtts[i];
-                download_avg_rtt += download_rtts[i];
-            }
-        }
-        download_avg_rtt /= num_latency_measurements;
+    // Per-interval series of each stream, and of all of them together
+    double download_bps[TS_SLOTS], upload_bps[TS_SLOTS];
+    int download_intervals = 0, upload_intervals = 0;
+    struct BW_series *download_series = calloc(download_conns, sizeof(*download_series));
+    if (download_series)
+    {
+        for (int i = 0; i < download_conns; i++)
+            download_series[i].count = ts_deltas(&download_args[i].series, download_series[i].bytes,
+                                                 &download_series[i].first);
+        if (per_stream)
+            print_series("Download", download_series, download_conns, TS_INTERVAL_MS);
+        download_intervals = aggregate_series(download_series, download_conns, TS_INTERVAL_MS, download_bps);
+        free(download_series);
+    }
 
-        printf("\nLatency measurements during download:\n");
-        printf("Min RTT: %.3f ms\n", download_min_rtt * 1000);
-        printf("Max RTT: %.3f ms\n", download_max_rtt * 1000);
-        printf("Avg RTT: %.3f ms\n", download_avg_rtt * 1000);
+    // Los de la bajada y después los de la subida, que puede usar otra cantidad de streams
+    tcp_summary_t *stream_tcp = malloc((download_conns + upload_conns) * sizeof *stream_tcp);
+    tcp_summary_t *upload_tcp = stream_tcp ? stream_tcp + download_conns : NULL;
+    tcp_summary_t tcp_download, tcp_upload;
+    if (stream_tcp)
+    {
+        for (int i = 0; i < download_conns; i++)
+            stream_tcp[i] = download_args[i].tcp;
+        print_tcp("Download", stream_tcp, download_conns, &tcp_download);
     }
 
     // Free download resources
     free(download_tids);
     free(download_args);
+    free(download_headers);
 
     // Allow some time between tests
     sleep(2);
@@ -263,29 +665,37 @@ int run_pipeline(const char *host, int num_connections, const char *result_ip, i
     // === Upload + Latency phase ===
     printf("\n=== Starting UPLOAD + latency test ===\n");
 
-    struct BW_result upload_result;
-    client_upload(host, N_CONN, &upload_result);
-    // Allocate memory for RTT measurements during upload
-    double *upload_rtts = calloc(num_latency_measurements, sizeof(double));
+    // The probes run while the upload streams, not after it
+    int upload_ended = 0;
     struct latency_arg upload_lat_arg = {
-        .host = host,
-        .rtts = upload_rtts,
-        .num_measurements = num_latency_measurements,
-        .completed = 0};
+        .host = host, .phase = "upload", .rate_hz = probe_hz, .flags = probe_flags, .duration = T_SECONDS,
+        .stop = &upload_ended};
     pthread_t upload_latency_tid;
+    int upload_latency_started = pthread_create(&upload_latency_tid, NULL, latency_thread, &upload_lat_arg) == 0;
+    if (!upload_latency_started)
+        perror("pthread_create for upload latency");
 
-    struct timespec t_start_upload, t_end_upload;
-    clock_gettime(CLOCK_MONOTONIC, &t_start_upload);
+    struct BW_result upload_result;
+    int upload_rc = client_upload(host, test_id, upload_conns, &upload_result, upload_send_mode, upload_tcp, adapt_tol,
+                                  per_stream);
+    __atomic_store_n(&upload_ended, 1, __ATOMIC_RELEASE);
+    if (upload_latency_started)
+        pthread_join(upload_latency_tid, NULL);
+    if (upload_rc < 0)
+    {
+        fprintf(stderr, "Error in upload test\n");
+        free(stream_tcp);
+        return -1;
+    }
+    upload_conns = upload_result.n_conn; // the streams that did connect
+    if (stream_tcp)
+        print_tcp("Upload", upload_tcp, upload_conns, &tcp_upload);
 
-    // Start latency measurement thread
-    if (pthread_create(&upload_latency_tid, NULL, latency_thread, &upload_lat_arg) != 0)
-        perror("pthread_create for upload latency");
-    // Upload is already called above
     // Calculate total bytes and find maximum duration
     uint64_t upload_total_bytes = 0;
     double upload_elapsed = 0.0;
 
-    for (int i = 0; i < N_CONN; i++)
+    for (int i = 0; i < upload_result.n_conn; i++)
     {
         upload_total_bytes += upload_result.conn_bytes[i];
         if (upload_result.conn_duration[i] > upload_elapsed)
@@ -295,37 +705,35 @@ int run_pipeline(const char *host, int num_connections, const char *result_ip, i
     }
 
     double upload_throughput = (upload_total_bytes * 8.0) / upload_elapsed; // in bps
-
-    pthread_join(upload_latency_tid, NULL);
-
-    clock_gettime(CLOCK_MONOTONIC, &t_end_upload);
+    if (per_stream)
+        print_series("Upload", upload_result.series, upload_result.n_conn, upload_result.interval_ms);
+    upload_intervals = aggregate_series(upload_result.series, upload_result.n_conn, upload_result.interval_ms,
+                                        upload_bps);
+    int upload_interval_ms = upload_result.interval_ms;
+    struct BW_tcp download_server = upload_result.download_tcp;
+    freeBwResult(&upload_result);
+    if (download_server.streams > 0)
+        printf("Download (server side): %u streams, %u retransmits, rwnd-limited %.3f s, sndbuf-limited %.3f s"
+               " of %.3f s busy\n",
+               download_server.streams, download_server.retrans, download_server.rwnd_limited_us / 1e6,
+               download_server.sndbuf_limited_us / 1e6, download_server.busy_us / 1e6);
 
     printf("Upload: sent %llu bytes\n", upload_total_bytes);
     printf("Upload: elapsed time %.3f seconds\n", upload_elapsed);
     printf("Upload: throughput %.2f Mb/s\n", upload_throughput / 1e6);
     if (upload_lat_arg.completed)
-    {
-        upload_min_rtt = upload_rtts[0];
-        upload_max_rtt = upload_rtts[0];
-        upload_avg_rtt = 0;
-
-        for (int i = 0; i < num_latency_measurements; i++)
-        {
-            if (upload_rtts[i] > 0)
-            {
-                if (upload_rtts[i] < upload_min_rtt)
-                    upload_min_rtt = upload_rtts[i];
-                if (upload_rtts[i] > upload_max_rtt)
-                    upload_max_rtt = upload_rtts[i];
-                upload_avg_rtt += upload_rtts[i];
-            }
-        }
-        upload_avg_rtt /= num_latency_measurements;
+        print_latency("during upload", &upload_lat_arg.probes);
 
-        printf("\nLatency measurements during upload:\n");
-        printf("Min RTT: %.3f ms\n", upload_min_rtt * 1000);
-        printf("Max RTT: %.3f ms\n", upload_max_rtt * 1000);
-        printf("Avg RTT: %.3f ms\n", upload_avg_rtt * 1000);
+    // Bajo carga: las dos direcciones juntas, frente a la línea base idle
+    lat_hist_t *loaded = malloc(sizeof *loaded);
+    if (loaded)
+    {
+        hist_init(loaded);
+        hist_merge(loaded, &download_lat_arg.probes.hist);
+        hist_merge(loaded, &upload_lat_arg.probes.hist);
+        printf("\nLatency under load (download + upload), %llu samples:\n", (unsigned long long)loaded->count);
+        print_percentiles("RTT", loaded);
+        free(loaded);
     }
 
     // Export results in JSON format
@@ -337,36 +745,130 @@ int run_pipeline(const char *host, int num_connections, const char *result_ip, i
         .avg_bw_download_bps = download_throughput,
         .upload_elapsed = upload_elapsed,
         .avg_bw_upload_bps = upload_throughput,
-        .num_conns = num_connections,
-        .rtt_idle = idle_rtt,
-        .rtt_download = download_avg_rtt,
-        .rtt_upload = upload_avg_rtt};
+        .num_conns = download_conns,
+        .num_conns_upload = upload_conns,
+        .ramp_download = ramp_threshold > 0 ? &download_ramp_res : NULL,
+        .ramp_upload = ramp_threshold > 0 ? &upload_ramp_res : NULL,
+        .adapt_tol = adapt_tol,
+        .rtt_idle = idle_lat_arg.probes.avg,
+        .rtt_download = download_lat_arg.probes.avg,
+        .rtt_upload = upload_lat_arg.probes.avg,
+        .loss_idle = lat_probe_loss(&idle_lat_arg.probes),
+        .loss_download = lat_probe_loss(&download_lat_arg.probes),
+        .loss_upload = lat_probe_loss(&upload_lat_arg.probes),
+        .hist_idle = &idle_lat_arg.probes.hist,
+        .hist_download = &download_lat_arg.probes.hist,
+        .hist_upload = &upload_lat_arg.probes.hist,
+        .kernel_ts = idle_lat_arg.probes.kernel_ts && download_lat_arg.probes.kernel_ts &&
+                     upload_lat_arg.probes.kernel_ts,
+        .rtt_kernel_idle = hist_mean(&idle_lat_arg.probes.kernel_hist) / 1e9,
+        .rtt_kernel_download = hist_mean(&download_lat_arg.probes.kernel_hist) / 1e9,
+        .rtt_kernel_upload = hist_mean(&upload_lat_arg.probes.kernel_hist) / 1e9,
+        .rtt_gap_idle = hist_mean(&idle_lat_arg.probes.gap_hist) / 1e9,
+        .rtt_gap_download = hist_mean(&download_lat_arg.probes.gap_hist) / 1e9,
+        .rtt_gap_upload = hist_mean(&upload_lat_arg.probes.gap_hist) / 1e9,
+        .owd_idle = &idle_lat_arg.probes.owd,
+        .owd_download = &download_lat_arg.probes.owd,
+        .owd_upload = &upload_lat_arg.probes.owd,
+        .tcp_download = stream_tcp ? &tcp_download : NULL,
+        .tcp_upload = stream_tcp ? &tcp_upload : NULL,
+        .tcp_download_streams = stream_tcp,
+        .tcp_upload_streams = upload_tcp,
+        .tcp_download_server = download_server.streams > 0 ? &download_server : NULL,
+        .interval_ms = TS_INTERVAL_MS,
+        .download_series = download_bps,
+        .download_intervals = download_intervals,
+        .upload_series = upload_bps,
+        .upload_intervals = upload_interval_ms == TS_INTERVAL_MS ? upload_intervals : 0};
 
     export_results_json(&results, result_ip, result_port);
-
-    // Free resources
-    free(idle_rtts);
-    free(download_rtts);
-    free(upload_rtts);
+    free(stream_tcp);
 
     return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 4)
+    // -z: cómo se envía el payload de subida (copy, msg = MSG_ZEROCOPY, sendfile)
+    // -d: cómo se descarta lo recibido en la descarga (auto, trunc, splice, read)
+    // -n: conexiones en paralelo por test, de 1 a MAX_CONN
+    // -p: sondas de latencia por segundo, de 1 a LAT_PROBE_MAX_HZ
+    // -k: RTT también con sellos de tiempo del kernel (SO_TIMESTAMPING)
+    // -a: duración adaptativa, corta cada fase cuando la tasa converge dentro de pct %
+    // -R: rampa de streams, los duplica mientras la tasa mejore más de pct %; -n es el tope
+    // -S: KB de payload por send() en la subida; -H: payload en páginas de 2 MB
+    // -P: contenido del payload, const ('A') o random (incompresible)
+    // -v: imprime la serie de cada stream; sin -v sólo la total, en el JSON
+    int upload_send_mode = ZC_MODE_COPY;
+    int download_recv_mode = DISCARD_AUTO;
+    int num_connections = N_CONN;
+    int probe_hz = LAT_PROBE_DEFAULT_HZ;
+    int probe_flags = 0;
+    double adapt_tol = 0, ramp_threshold = 0;
+    size_t send_size = PAYLOAD;
+    int c, bad = 0, streams_given = 0, payload_flags = 0, per_stream = 0;
+    while ((c = getopt(argc, argv, "z:d:n:p:ka:R:S:HP:v")) != -1)
+    {
+        if (c == 'v')
+            per_stream = 1;
+        else if (c == 'P')
+        {
+            int fill = payload_mode_parse(optarg);
+            bad |= fill < 0;
+            payload_flags = (payload_flags & ~PAYLOAD_RANDOM) | (fill > 0 ? fill : 0);
+        }
+        else if (c == 'H')
+            payload_flags |= PAYLOAD_HUGEPAGES;
+        else if (c == 'S')
+            bad |= (send_size = (size_t)atoi(optarg) * 1024) < 1 || send_size > PAYLOAD_MAX_SEND;
+        else if (c == 'R')
+            bad |= (ramp_threshold = atof(optarg) / 100) <= 0;
+        else if (c == 'a')
+            bad |= (adapt_tol = atof(optarg) / 100) <= 0 || adapt_tol >= 1;
+        else if (c == 'k')
+            probe_flags |= LAT_PROBE_KERNEL_TS;
+        else if (c == 'p')
+            bad |= (probe_hz = atoi(optarg)) < 1 || probe_hz > LAT_PROBE_MAX_HZ;
+        else if (c == 'n')
+        {
+            bad |= (num_connections = atoi(optarg)) < 1 || num_connections > MAX_CONN;
+            streams_given = 1;
+        }
+        else if (c == 'z')
+            bad |= (upload_send_mode = zc_mode_parse(optarg)) < 0;
+        else if (c == 'd')
+            bad |= (download_recv_mode = discard_mode_parse(optarg)) < DISCARD_AUTO;
+        else
+            bad = 1;
+    }
+    if (bad || argc - optind != 3)
     {
-        fprintf(stderr, "Uso: %s host result_ip result_port\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-n streams] [-p probe_hz] [-k] [-a pct] [-R pct] [-S send_kb] [-H] [-P const|random] [-v] [-z copy|msg|sendfile] [-d auto|trunc|splice|read] host result_ip result_port\n",
+                argv[0]);
         return 1;
     }
-    const char *host = argv[1];
-    const char *result_ip = argv[2];
-    int result_port = atoi(argv[3]);
+    const char *host = argv[optind];
+    const char *result_ip = argv[optind + 1];
+    int result_port = atoi(argv[optind + 2]);
+    if (ramp_threshold > 0 && !streams_given)
+        num_connections = RAMP_DEFAULT_MAX;
+
+    if (num_connections > N_CONN && raise_fd_limit() < 4L * num_connections)
+        fprintf(stderr, "client: open files limit may be too low for %d streams\n", num_connections);
+
+    if (payload_init(send_size, payload_flags | PAYLOAD_UPLOAD) < 0)
+        return 1;
+    if (payload_rng() >= 0)
+        printf("client: random upload payload (%s), %zu KB\n", payload_rng_name(payload_rng()), payload_len() / 1024);
+    upload_send_mode = zc_init(upload_send_mode);
+    if (upload_send_mode < 0)
+        return 1;
 
-    printf("Starting throughput and latency test pipeline for host: %s with %d connection(s).\n", host, N_CONN);
+    printf("Starting throughput and latency test pipeline for host: %s with %d connection(s).\n", host, num_connections);
     printf("The pipeline will perform both download and upload tests with latency measurements.\n");
 
-    int result = run_pipeline(host, N_CONN, result_ip, result_port);
+    int result = run_pipeline(host, num_connections, result_ip, result_port, upload_send_mode, download_recv_mode,
+                              probe_hz, probe_flags, adapt_tol, ramp_threshold, per_stream);
 
     if (result == 0)
         printf("\nPipeline completed successfully - both download and upload tests finished.\n");
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200112L
+#define _GNU_SOURCE
 
 #include "common.h"
 #include <arpa/inet.h>
@@ -8,6 +8,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <netdb.h> // For getaddrinfo
+#include <sched.h> // For sched_getaffinity
+#include <fcntl.h> // For fcntl
+#include <sys/resource.h> // For setrlimit
 
 int udp_socket_init(const char *host, int port, struct sockaddr_in *server_addr_out, int do_bind)
 {
@@ -43,7 +46,19 @@ int udp_socket_init(const char *host, int port, struct sockaddr_in *server_addr_
                 continue;
             }
 
-            if (do_bind) // Server: bind to the address
+            if (do_bind & UDP_SOCK_REUSEPORT)
+            {
+                const int yes = 1;
+                if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1)
+                {
+                    close(sockfd);
+                    perror("udp_socket_init: SO_REUSEPORT");
+                    sockfd = -1;
+                    continue;
+                }
+            }
+
+            if (do_bind & UDP_SOCK_BIND) // Server: bind to the address
             {
                 if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1)
                 {
@@ -71,6 +86,64 @@ int udp_socket_init(const char *host, int port, struct sockaddr_in *server_addr_
     return sockfd;
 }
 
+int cpu_count(void)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof set, &set) == -1)
+        return -1;
+    return CPU_COUNT(&set);
+}
+
+int cpu_by_index(int i)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof set, &set) == -1)
+        return -1;
+
+    int count = CPU_COUNT(&set);
+    if (count == 0)
+        return -1;
+    i %= count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set) && i-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+int thread_attr_pin(pthread_attr_t *attr, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_attr_setaffinity_np(attr, sizeof set, &set);
+}
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+long raise_fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        return -1;
+    if (rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            return -1;
+    }
+    return (long)rl.rlim_cur;
+}
+
 struct timespec now_ts(void)
 {
     struct timespec t;
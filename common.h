@@ -6,16 +6,60 @@
 #include <netinet/in.h>
 #include <time.h>
 #include <pthread.h>
-#include "config.h" // For MAX_CLIENTS, BW_result
+#include "config.h"        // For MAX_CLIENTS
+#include "handle_result.h" // For NUM_CONN
+#include "series.h"        // For ts_ring_t
 
-typedef struct results_lock
+#define CACHE_LINE 64
+
+// Upload counters of one connection, written only by the thread serving it.
+// Each one fills its own cache line, so concurrent streams never share one;
+// the series, 2 KB, lives in its own allocation.
+typedef struct conn_counter
+{
+    uint64_t bytes;    // published last, with release semantics
+    double duration;   // seconds of effective reading
+    int fd;            // connection writing it, for the results reaper; -1 once released
+    ts_ring_t *series; // totals per TS_INTERVAL_MS since the connection started; NULL if none
+} __attribute__((aligned(CACHE_LINE))) conn_counter_t;
+
+// Publishes the running totals of a connection (single writer)
+static inline void conn_counter_publish(conn_counter_t *c, uint64_t bytes, double duration)
 {
-    pthread_mutex_t mutex;
-    struct BW_result *results; // Array to store results for each client
-} results_lock_t;
+    if (c->series)
+        ts_record(c->series, duration, bytes);
+    __atomic_store(&c->duration, &duration, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bytes, bytes, __ATOMIC_RELEASE);
+}
+
+// Reads what conn_counter_publish() stored; duration is at least as recent as bytes
+static inline void conn_counter_read(conn_counter_t *c, uint64_t *bytes, double *duration)
+{
+    *bytes = __atomic_load_n(&c->bytes, __ATOMIC_ACQUIRE);
+    __atomic_load(&c->duration, duration, __ATOMIC_RELAXED);
+}
+
+// Flags for udp_socket_init() (1 keeps meaning "bind")
+#define UDP_SOCK_BIND 1
+#define UDP_SOCK_REUSEPORT 2 // share the port with other SO_REUSEPORT sockets
 
 int udp_socket_init(const char *srv_ip, int port, struct sockaddr_in *srv_addr, int bind_flag);
 
+// i-th CPU (modulo count) this process may run on, -1 on error
+int cpu_by_index(int i);
+
+// How many CPUs this process may run on, -1 on error
+int cpu_count(void);
+
+// Makes threads created with attr start pinned to cpu
+int thread_attr_pin(pthread_attr_t *attr, int cpu);
+
+int set_nonblocking(int fd);
+
+// Raises the open files soft limit to the hard one: every stream costs a
+// socket, plus a pipe with the splice discard. Returns the new limit.
+long raise_fd_limit(void);
+
 struct timespec now_ts(void);
 
 double diff_ts(const struct timespec *start, const struct timespec *end);
@@ -1,9 +1,9 @@
 #pragma once
 #define T_SECONDS 20
-#define RTT_TRIES 3
+#define IDLE_PROBE_SECONDS 1 // latency probing before the download starts
 #define CLOSE_AFTER 3
 #define TCP_PORT_DOWN "20251"
-#define MAX_BACKLOG 64
+#define MAX_BACKLOG 1024 // a client may connect all its streams at once
 #define PAYLOAD 16384
 #define N_CONN 10
 #define MAX_CLIENTS 4
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "deadline.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+uint64_t dl_clock_ns;
+
+// The list is sorted by at_ns; tests start in order, so arming is mostly an append
+static pthread_mutex_t dl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dl_wake = PTHREAD_COND_INITIALIZER;
+static deadline_t *dl_head, *dl_tail;
+static int dl_holders;
+static int dl_started;
+
+static uint64_t mono_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+static void unlink_locked(deadline_t *d)
+{
+    if (d->prev)
+        d->prev->next = d->next;
+    else
+        dl_head = d->next;
+    if (d->next)
+        d->next->prev = d->prev;
+    else
+        dl_tail = d->prev;
+    d->prev = d->next = NULL;
+    d->armed = 0;
+}
+
+static void *dl_thread(void *unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&dl_lock);
+    while (1)
+    {
+        // Nothing to time: no ticks either
+        while (!dl_head && dl_holders == 0)
+            pthread_cond_wait(&dl_wake, &dl_lock);
+
+        uint64_t now = mono_ns();
+        __atomic_store_n(&dl_clock_ns, now, __ATOMIC_RELAXED);
+        while (dl_head && dl_head->at_ns <= now)
+        {
+            deadline_t *d = dl_head;
+            unlink_locked(d);
+            // Under the lock: dl_cancel() cannot return, and the fd be closed, meanwhile
+            if (d->fd >= 0)
+                shutdown(d->fd, d->how);
+            __atomic_store_n(&d->expired, 1, __ATOMIC_RELEASE);
+        }
+
+        uint64_t next = now + DL_TICK_MS * 1000000ULL;
+        if (dl_head && dl_head->at_ns < next)
+            next = dl_head->at_ns;
+        pthread_mutex_unlock(&dl_lock);
+        struct timespec ts = {.tv_sec = next / 1000000000ULL, .tv_nsec = next % 1000000000ULL};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        pthread_mutex_lock(&dl_lock);
+    }
+    return NULL;
+}
+
+// With dl_lock held
+static int start_locked(void)
+{
+    if (!dl_started)
+    {
+        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int rc = pthread_create(&tid, &attr, dl_thread, NULL);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            fprintf(stderr, "deadline: cannot start the timer thread\n");
+            return -1;
+        }
+        dl_started = 1;
+    }
+    // The clock may have been stopped: callers read it right away
+    __atomic_store_n(&dl_clock_ns, mono_ns(), __ATOMIC_RELAXED);
+    pthread_cond_signal(&dl_wake);
+    return 0;
+}
+
+int dl_arm(deadline_t *d, const struct timespec *start, double seconds, int fd, int how)
+{
+    d->at_ns = (uint64_t)start->tv_sec * 1000000000ULL + (uint64_t)start->tv_nsec + (uint64_t)(seconds * 1e9);
+    d->fd = fd;
+    d->how = how;
+    d->expired = 0;
+    d->prev = d->next = NULL;
+
+    pthread_mutex_lock(&dl_lock);
+    if (start_locked() < 0)
+    {
+        d->armed = 0;
+        pthread_mutex_unlock(&dl_lock);
+        return -1;
+    }
+    deadline_t *p = dl_tail;
+    while (p && p->at_ns > d->at_ns)
+        p = p->prev;
+    d->prev = p;
+    d->next = p ? p->next : dl_head;
+    if (d->next)
+        d->next->prev = d;
+    else
+        dl_tail = d;
+    if (p)
+        p->next = d;
+    else
+        dl_head = d;
+    d->armed = 1;
+    pthread_mutex_unlock(&dl_lock);
+    return 0;
+}
+
+void dl_cancel(deadline_t *d)
+{
+    pthread_mutex_lock(&dl_lock);
+    if (d->armed)
+        unlink_locked(d);
+    pthread_mutex_unlock(&dl_lock);
+}
+
+int dl_hold(void)
+{
+    pthread_mutex_lock(&dl_lock);
+    int rc = start_locked();
+    if (rc == 0)
+        dl_holders++;
+    pthread_mutex_unlock(&dl_lock);
+    return rc;
+}
+
+void dl_release(void)
+{
+    pthread_mutex_lock(&dl_lock);
+    dl_holders--;
+    pthread_mutex_unlock(&dl_lock);
+}
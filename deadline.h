@@ -0,0 +1,72 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define DL_TICK_MS 5 // resolution of the coarse clock while someone uses it
+
+/**
+ * @brief End of a transfer, fired by the process-wide timer thread.
+ *
+ * Transfer loops arm one per connection and then only check dl_expired(),
+ * an atomic load, instead of reading the clock on every send or recv. The
+ * timer thread sleeps until the earliest deadline (or the next tick) and
+ * fires it on time, not on whole-second boundaries. If fd is set, it also
+ * shuts the socket down, so a loop blocked in send() or recv() returns
+ * right away.
+ */
+typedef struct deadline
+{
+    uint64_t at_ns; // CLOCK_MONOTONIC
+    int fd;         // -1: only the flag
+    int how;        // for shutdown(): SHUT_RD, SHUT_WR, SHUT_RDWR
+    int expired;    // set last, with release semantics
+    int armed;      // still in the timer's list
+    struct deadline *prev, *next;
+} deadline_t;
+
+/**
+ * @brief Arms d to fire seconds after start.
+ *
+ * d must stay alive until it fires or dl_cancel() returns. Starts the
+ * timer thread the first time.
+ *
+ * @param fd Socket to shut down with how when d fires, or -1.
+ * @return int 0, or -1 if the timer thread could not be started.
+ */
+int dl_arm(deadline_t *d, const struct timespec *start, double seconds, int fd, int how);
+
+/**
+ * @brief Disarms d if it has not fired yet.
+ *
+ * Call it before closing the fd given to dl_arm(): once it returns the
+ * timer thread no longer touches d nor the socket.
+ */
+void dl_cancel(deadline_t *d);
+
+static inline int dl_expired(const deadline_t *d)
+{
+    return __atomic_load_n(&d->expired, __ATOMIC_ACQUIRE);
+}
+
+// Keeps the coarse clock running for a loop without a deadline of its own
+int dl_hold(void);
+void dl_release(void);
+
+extern uint64_t dl_clock_ns; // CLOCK_MONOTONIC at the last tick
+
+/**
+ * @brief Seconds since start on the coarse clock, never negative.
+ *
+ * Up to DL_TICK_MS behind the real clock; valid while a deadline is armed
+ * or the clock is held.
+ */
+static inline double dl_elapsed(const struct timespec *start)
+{
+    int64_t ns = (int64_t)(__atomic_load_n(&dl_clock_ns, __ATOMIC_RELAXED) -
+                           ((uint64_t)start->tv_sec * 1000000000ULL + (uint64_t)start->tv_nsec));
+    return ns > 0 ? ns / 1e9 : 0;
+}
+
+#endif // DEADLINE_H
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+
+#include "discard.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *const discard_names[] = {"trunc", "splice", "read"};
+
+const char *discard_mode_name(int method)
+{
+    if (method == DISCARD_AUTO)
+        return "auto";
+    return (method >= DISCARD_TRUNC && method <= DISCARD_READ) ? discard_names[method] : "?";
+}
+
+int discard_mode_parse(const char *name)
+{
+    if (strcmp(name, "auto") == 0)
+        return DISCARD_AUTO;
+    for (int i = DISCARD_TRUNC; i <= DISCARD_READ; i++)
+    {
+        if (strcmp(name, discard_names[i]) == 0)
+            return i;
+    }
+    return -2;
+}
+
+#ifdef __linux__
+static int splice_init(discard_t *d)
+{
+    if (pipe2(d->pipe_fds, O_CLOEXEC) == -1)
+    {
+        perror("pipe2 (discard)");
+        return -1;
+    }
+    // A larger pipe lets one splice() move a whole DISCARD_CHUNK
+    fcntl(d->pipe_fds[1], F_SETPIPE_SZ, DISCARD_CHUNK);
+    d->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (d->null_fd == -1)
+    {
+        perror("open /dev/null (discard)");
+        close(d->pipe_fds[0]);
+        close(d->pipe_fds[1]);
+        d->pipe_fds[0] = d->pipe_fds[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+int discard_init(discard_t *d, int method)
+{
+    memset(d, 0, sizeof *d);
+    d->pipe_fds[0] = d->pipe_fds[1] = d->null_fd = -1;
+
+#ifdef __linux__
+    if (method == DISCARD_AUTO || method == DISCARD_TRUNC)
+    {
+        d->method = DISCARD_TRUNC;
+        return d->method;
+    }
+    if (method == DISCARD_SPLICE && splice_init(d) == 0)
+    {
+        d->method = DISCARD_SPLICE;
+        return d->method;
+    }
+#endif
+
+    d->scratch = malloc(DISCARD_CHUNK);
+    if (!d->scratch)
+    {
+        perror("malloc (discard)");
+        return -1;
+    }
+    d->method = DISCARD_READ;
+    return d->method;
+}
+
+void discard_destroy(discard_t *d)
+{
+    if (d->pipe_fds[0] >= 0)
+    {
+        close(d->pipe_fds[0]);
+        close(d->pipe_fds[1]);
+    }
+    if (d->null_fd >= 0)
+        close(d->null_fd);
+    free(d->scratch);
+    d->scratch = NULL;
+}
+
+void discard_prepare_socket(const discard_t *d, int fd)
+{
+    const int lowat = DISCARD_LOWAT;
+    if (d->method == DISCARD_READ)
+        setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof lowat);
+}
+
+ssize_t discard_recv(discard_t *d, int fd, int flags)
+{
+    switch (d->method)
+    {
+#ifdef __linux__
+    case DISCARD_TRUNC:
+        // TCP with MSG_TRUNC: the bytes are consumed and dropped, buf may be NULL
+        return recv(fd, NULL, DISCARD_CHUNK, flags | MSG_TRUNC);
+
+    case DISCARD_SPLICE:
+    {
+        unsigned sflags = SPLICE_F_MOVE | ((flags & MSG_DONTWAIT) ? SPLICE_F_NONBLOCK : 0);
+        ssize_t n = splice(fd, NULL, d->pipe_fds[1], NULL, DISCARD_CHUNK, sflags);
+        if (n <= 0)
+            return n;
+        // Drain everything we put in; /dev/null never blocks
+        for (ssize_t left = n; left > 0;)
+        {
+            ssize_t m = splice(d->pipe_fds[0], NULL, d->null_fd, NULL, left, SPLICE_F_MOVE);
+            if (m <= 0)
+            {
+                if (m < 0 && errno == EINTR)
+                    continue;
+                return -1;
+            }
+            left -= m;
+        }
+        return n;
+    }
+#endif
+
+    default:
+        return recv(fd, d->scratch, DISCARD_CHUNK, flags);
+    }
+}
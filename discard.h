@@ -0,0 +1,50 @@
+#ifndef DISCARD_H
+#define DISCARD_H
+
+#include <sys/types.h>
+
+// Receive-and-discard methods (server and client -d)
+#define DISCARD_AUTO -1  // best method this platform supports
+#define DISCARD_TRUNC 0  // recv(MSG_TRUNC): Linux TCP drops the data in the kernel
+#define DISCARD_SPLICE 1 // splice() socket -> pipe -> /dev/null, pages are never mapped
+#define DISCARD_READ 2   // recv() into a scratch buffer, batched with SO_RCVLOWAT
+
+#define DISCARD_CHUNK (256 * 1024) // bytes asked for per call
+#define DISCARD_LOWAT (64 * 1024)  // SO_RCVLOWAT for DISCARD_READ
+
+// Per-thread discard engine: the pipe and scratch buffer are not shared
+typedef struct discard
+{
+    int method;
+    int pipe_fds[2]; // DISCARD_SPLICE
+    int null_fd;     // DISCARD_SPLICE
+    char *scratch;   // DISCARD_READ
+} discard_t;
+
+/**
+ * @brief Sets up a discard engine.
+ *
+ * @param method DISCARD_AUTO or one of DISCARD_*. A method the platform
+ *        cannot provide falls back to the next one (TRUNC, SPLICE, READ).
+ * @return int The method in use, or -1 on error.
+ */
+int discard_init(discard_t *d, int method);
+
+void discard_destroy(discard_t *d);
+
+// Per-socket setup (SO_RCVLOWAT for DISCARD_READ)
+void discard_prepare_socket(const discard_t *d, int fd);
+
+/**
+ * @brief Receives and drops up to DISCARD_CHUNK bytes from a TCP socket.
+ *
+ * @param flags Extra recv() flags, e.g. MSG_DONTWAIT.
+ * @return ssize_t Bytes discarded, 0 on EOF, -1 with errno set as by recv().
+ */
+ssize_t discard_recv(discard_t *d, int fd, int flags);
+
+// Name of a method for logs; parses one with discard_mode_parse (-2 if unknown)
+const char *discard_mode_name(int method);
+int discard_mode_parse(const char *name);
+
+#endif // DISCARD_H
@@ -2,47 +2,121 @@
 
 #include "download.h"
 #include "config.h"     // For T_SECONDS, PAYLOAD
+#include "zerocopy.h"   // For zc_sender_t, zc_send
+#include "discard.h"    // For discard_t, discard_recv
+#include "deadline.h"   // For dl_arm, dl_expired, dl_elapsed
+#include <errno.h>      // For errno
 #include <stdio.h>      // For perror, fprintf
+#include <stdlib.h>     // For malloc, free
 #include <string.h>     // For memset
 #include <unistd.h>     // For read, send, close
 #include <time.h>       // For clock_gettime, struct timespec
 #include <sys/socket.h> // For socket, connect, send, read
 #include <netdb.h>      // For getaddrinfo, struct addrinfo, gai_strerror
+#include <arpa/inet.h>  // For ntohs
 
-int server_handle_download_client(int client_socket_fd)
+#define ZC_FINISH_WAIT_MS 200 // wait for the last MSG_ZEROCOPY completions
+
+void server_download_report(results_table_t *results, int fd, const tcp_summary_t *tcp)
+{
+    // The header came right after connect, a whole test ago. Drain all the
+    // client sent: data left unread would turn close() into a reset
+    uint8_t header[DOWNLOAD_HEADER_LEN], rest[64];
+    size_t got = 0;
+    ssize_t n;
+    while ((n = got < sizeof header ? recv(fd, header + got, sizeof header - got, MSG_DONTWAIT)
+                                    : recv(fd, rest, sizeof rest, MSG_DONTWAIT)) > 0)
+        got += (size_t)n;
+    shutdown(fd, SHUT_WR); // the FIN goes out after the last payload byte
+    if (!results || got < sizeof header)
+        return;
+
+    uint32_t test_id;
+    uint16_t conn_id;
+    memcpy(&test_id, header, sizeof test_id);
+    memcpy(&conn_id, header + 4, sizeof conn_id);
+    if (ntohs(conn_id) < 1 || ntohs(conn_id) > MAX_CONN)
+    {
+        fprintf(stderr, "server: invalid download connection id %u (fd: %d)\n", ntohs(conn_id), fd);
+        return;
+    }
+    int rc = rt_add_download(results, test_id, tcp);
+    if (rc == RT_FULL)
+        fprintf(stderr, "server: results table full, download summary dropped (fd: %d)\n", fd);
+    else if (rc == RT_REPORTED)
+        fprintf(stderr, "server: download ended after its test was reported (fd: %d)\n", fd);
+}
+
+int server_handle_download_client(int client_socket_fd, int send_mode, results_table_t *results)
 {
     if (client_socket_fd < 0)
     {
         return DOWNLOAD_PARAM_ERR;
     }
 
-    char buffer[PAYLOAD];
-    memset(buffer, 'A', sizeof(buffer)); // Fill buffer with data
+    zc_sender_t *zc = malloc(sizeof *zc); // ZC_RING lengths: too big for a small worker stack
+    if (!zc)
+    {
+        perror("malloc in server_handle_download_client");
+        return DOWNLOAD_PARAM_ERR;
+    }
+    zc_sender_init(zc, client_socket_fd, send_mode);
+    tcp_summary_t tcp;
+    tcpi_init(&tcp);
 
-    struct timespec start_time, current_time;
+    // The timer thread ends the test: the loop only checks the flag. Shutting
+    // the socket down also wakes a send() blocked on a client that stalled.
+    struct timespec start_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
+    deadline_t deadline;
+    if (dl_arm(&deadline, &start_time, T_SECONDS, client_socket_fd, SHUT_WR) < 0)
+    {
+        free(zc);
+        return DOWNLOAD_PARAM_ERR;
+    }
 
     // Send data continuously for T_SECONDS
-    while (1)
+    while (!dl_expired(&deadline))
     {
-        clock_gettime(CLOCK_MONOTONIC, &current_time);
-        if (current_time.tv_sec - start_time.tv_sec >= T_SECONDS)
-        {
-            break;
-        }
+        tcpi_poll(client_socket_fd, &tcp, dl_elapsed(&start_time));
 
-        if (send(client_socket_fd, buffer, sizeof(buffer), 0) == -1)
+        if (zc_send(zc, MSG_NOSIGNAL) == -1)
         {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            if (dl_expired(&deadline))
+                break; // the shutdown at the deadline
+            if (errno == EPIPE || errno == ECONNRESET)
+            {
+                // The client closed: it got what it needed before T_SECONDS
+                printf("server: client stopped the download after %.1f s (fd: %d)\n",
+                       dl_elapsed(&start_time), client_socket_fd);
+                break;
+            }
             perror("send in server_handle_download_client");
+            dl_cancel(&deadline);
+            zc_sender_finish(zc, 0);
+            free(zc);
             return DOWNLOAD_SEND_ERR;
         }
     }
+    dl_cancel(&deadline);
+    zc_sender_finish(zc, ZC_FINISH_WAIT_MS);
+    tcpi_sample(client_socket_fd, &tcp);
     // close(client_socket_fd); // The caller of this function (server_download.c) will close it.
-    printf("server: finished sending data to client (fd: %d)\n", client_socket_fd);
+    char what[64];
+    snprintf(what, sizeof what, "server: finished sending data to client (fd: %d)", client_socket_fd);
+    zc_print_stats(&zc->stats, what);
+    snprintf(what, sizeof what, "server: download TCP (fd: %d)", client_socket_fd);
+    tcpi_print(&tcp, what);
+    server_download_report(results, client_socket_fd, &tcp);
+    free(zc);
     return DOWNLOAD_OK;
 }
 
-int client_perform_download(const char *host, const char *port, int duration_seconds, uint64_t *bytes_transferred)
+int client_perform_download(const char *host, const char *port, int duration_seconds, uint64_t *bytes_transferred,
+                            int recv_mode, ts_ring_t *series, tcp_summary_t *tcp, const int *stop,
+                            const uint8_t *header)
 {
     if (!host || !port || duration_seconds <= 0 || !bytes_transferred)
     {
@@ -80,30 +154,66 @@ int client_perform_download(const char *host, const char *port, int duration_sec
     }
     freeaddrinfo(servinfo); // all done with this structure
 
-    char buf[PAYLOAD];
+    if (header && send(s, header, DOWNLOAD_HEADER_LEN, MSG_NOSIGNAL) != DOWNLOAD_HEADER_LEN)
+    {
+        perror("send header in client_perform_download");
+        close(s);
+        return DOWNLOAD_SEND_ERR;
+    }
+
+    discard_t sink;
+    if (discard_init(&sink, recv_mode) < 0)
+    {
+        close(s);
+        return DOWNLOAD_PARAM_ERR;
+    }
+    discard_prepare_socket(&sink, s);
+
     ssize_t n;
-    struct timespec t0, now;
+    struct timespec t0;
     clock_gettime(CLOCK_MONOTONIC, &t0);
+    deadline_t deadline;
+    if (dl_arm(&deadline, &t0, duration_seconds + DOWNLOAD_GRACE_S, s, SHUT_RD) < 0)
+    {
+        discard_destroy(&sink);
+        close(s);
+        return DOWNLOAD_PARAM_ERR;
+    }
 
-    *bytes_transferred = 0;
+    // Others may read it while we receive
+    uint64_t total = 0;
+    __atomic_store_n(bytes_transferred, 0, __ATOMIC_RELAXED);
 
-    while ((n = read(s, buf, sizeof buf)) > 0)
+    // Normally the server's EOF ends it; at our deadline the read side is shut
+    // down and the recv returns 0
+    while ((n = discard_recv(&sink, s, 0)) > 0)
     {
-        *bytes_transferred += n;
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        if (now.tv_sec - t0.tv_sec >= duration_seconds)
+        total += n;
+        __atomic_store_n(bytes_transferred, total, __ATOMIC_RELAXED);
+        double elapsed = dl_elapsed(&t0);
+        if (series)
+            ts_record(series, elapsed, total);
+        if (tcp)
+            tcpi_poll(s, tcp, elapsed);
+        if (dl_expired(&deadline) || (stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE)))
         {
             break;
         }
     }
+    dl_cancel(&deadline);
 
     if (n < 0)
     {
-        perror("read in client_perform_download");
+        perror("recv in client_perform_download");
+        discard_destroy(&sink);
         close(s);
         return DOWNLOAD_RECV_ERR;
     }
+    discard_destroy(&sink);
+    if (tcp)
+        tcpi_sample(s, tcp);
 
-    // close(s); // The caller of this function (client_download.c) will close it.
+    // Unread data makes this a reset: the server stops sending right away
+    close(s);
     return DOWNLOAD_OK;
 }
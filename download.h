@@ -2,6 +2,9 @@
 #define DOWNLOAD_H
 
 #include <stdint.h> // For uint64_t
+#include "series.h" // For ts_ring_t
+#include "tcpinfo.h" // For tcp_summary_t
+#include "results_table.h" // For results_table_t
 
 // Error codes
 #define DOWNLOAD_OK 0
@@ -13,28 +16,62 @@
 #define DOWNLOAD_GETADDRINFO_ERR (DOWNLOAD_ERROR_BASE - 5)
 #define DOWNLOAD_PARAM_ERR (DOWNLOAD_ERROR_BASE - 6)
 
+// The server ends the stream at its deadline; the client's is only a safety net
+#define DOWNLOAD_GRACE_S 0.5
+
+// Sent by the client right after connecting, like the upload header:
+// test_id (4) + conn_id (2, 1..MAX_CONN). Optional; older clients send nothing
+#define DOWNLOAD_HEADER_LEN 6
+
 /**
  * @brief Handles a single client connection on the server side for download.
  *
- * Sends a continuous stream of data to the client for a predefined duration (T_SECONDS).
+ * Sends a continuous stream of data to the client for a predefined duration (T_SECONDS),
+ * or until the client closes the connection to end the test early.
+ * zc_init() must have been called with send_mode (or the mode it returned).
+ * TCP_INFO is sampled every TCPI_INTERVAL_MS and summarized in the log,
+ * and in results (server_download_report()) if the client sent a header.
  *
  * @param client_socket_fd The file descriptor of the connected client socket.
+ * @param send_mode How the payload is handed to the kernel (ZC_MODE_*).
+ * @param results Table the summary is added to, or NULL.
  * @return int DOWNLOAD_OK on success, or an error code on failure.
  */
-int server_handle_download_client(int client_socket_fd);
+int server_handle_download_client(int client_socket_fd, int send_mode, results_table_t *results);
+
+/**
+ * @brief Adds a finished download's TCP_INFO summary to its test in results.
+ *
+ * Reads the client's DOWNLOAD_HEADER_LEN header without blocking, drains
+ * anything after it and shuts the sending side down, so close() ends the
+ * stream with a FIN rather than a reset. A connection without a header (an
+ * older client) is not reported. Call it right before closing fd.
+ */
+void server_download_report(results_table_t *results, int fd, const tcp_summary_t *tcp);
 
 /**
  * @brief Performs a download operation from the client side.
  *
- * Connects to the specified server, receives data for a predefined duration,
- * and updates the total bytes transferred.
+ * Connects to the specified server, receives data until the server closes the
+ * stream (or for DOWNLOAD_GRACE_S beyond duration_seconds at most), and updates
+ * the total bytes transferred. The data is only counted, never
+ * copied into user space unless the discard method is DISCARD_READ.
  *
  * @param host The hostname or IP address of the server.
  * @param port The port number of the server.
  * @param duration_seconds The duration for which to download data.
  * @param bytes_transferred Pointer to a uint64_t to store the total bytes received.
+ * @param recv_mode Discard method (DISCARD_AUTO or DISCARD_*).
+ * @param series If not NULL, gets the bytes received per TS_INTERVAL_MS.
+ * @param tcp If not NULL, gets the TCP_INFO samples of the connection.
+ * @param stop If not NULL, setting *stop ends the download before duration_seconds;
+ *        closing the connection tells the server to stop sending.
+ * @param header If not NULL, the DOWNLOAD_HEADER_LEN bytes sent after connecting, so the
+ *        server reports its side of the stream with the test's results.
  * @return int DOWNLOAD_OK on success, or an error code on failure.
  */
-int client_perform_download(const char *host, const char *port, int duration_seconds, uint64_t *bytes_transferred);
+int client_perform_download(const char *host, const char *port, int duration_seconds, uint64_t *bytes_transferred,
+                            int recv_mode, ts_ring_t *series, tcp_summary_t *tcp, const int *stop,
+                            const uint8_t *header);
 
 #endif // DOWNLOAD_H
@@ -0,0 +1,414 @@
+#define _GNU_SOURCE
+
+#include "event_loop.h"
+#include "config.h"
+#include "upload.h"
+#include "download.h"
+#include "zerocopy.h"
+#include "discard.h"
+#include "tcpinfo.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define EL_MAX_EVENTS 256
+#define EL_SEND_BURST 16 // sends per wakeup before serving other connections
+#define EL_RECV_BURST 16 // recvs per wakeup before serving other connections
+
+enum el_kind
+{
+    EL_LISTEN_DOWN,
+    EL_LISTEN_UP,
+    EL_CONN
+};
+
+enum el_state
+{
+    CONN_DOWNLOAD,      // sending payload until the deadline
+    CONN_UPLOAD_HEADER, // waiting for the 6-byte header (test_id + conn_id)
+    CONN_UPLOAD_DATA    // receiving payload until the deadline or EOF
+};
+
+// epoll data.ptr points to either of these; kind must be the first member
+typedef struct el_listener
+{
+    enum el_kind kind;
+    int fd;
+} el_listener_t;
+
+typedef struct el_conn
+{
+    enum el_kind kind;
+    enum el_state state;
+    int fd;
+    struct timespec start;
+    struct timespec deadline;
+    uint8_t header[6];
+    size_t header_len;
+    rt_entry_t *entry;       // upload: test in the results table, released on close
+    conn_counter_t *counter; // upload: this connection's counter in entry
+    uint64_t bytes;          // upload: running total, published to counter
+    zc_sender_t *zc; // download: payload sender
+    tcp_summary_t tcp;           // TCP_INFO samples, logged on close
+    struct el_conn *prev, *next; // deadline list
+} el_conn_t;
+
+typedef struct event_loop
+{
+    int id;
+    int epfd;
+    const event_loop_cfg_t *cfg;
+    el_listener_t down;
+    el_listener_t up;
+    // Every connection lives exactly T seconds, so appending on accept keeps
+    // the list sorted by deadline and the head is always the next to expire.
+    el_conn_t *head, *tail;
+    int n_conns;
+    discard_t sink; // upload data is counted and dropped here
+    pthread_t thr;
+} event_loop_t;
+
+static int ts_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void conn_link(event_loop_t *loop, el_conn_t *c)
+{
+    c->prev = loop->tail;
+    c->next = NULL;
+    if (loop->tail)
+        loop->tail->next = c;
+    else
+        loop->head = c;
+    loop->tail = c;
+    loop->n_conns++;
+}
+
+static void conn_close(event_loop_t *loop, el_conn_t *c)
+{
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        loop->head = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    else
+        loop->tail = c->prev;
+    loop->n_conns--;
+
+    char what[64];
+    tcpi_sample(c->fd, &c->tcp);
+    snprintf(what, sizeof what, "server: %s TCP (fd: %d)", c->state == CONN_DOWNLOAD ? "download" : "upload", c->fd);
+    tcpi_print(&c->tcp, what);
+
+    if (c->state == CONN_DOWNLOAD)
+    {
+        // Non-blocking: completions still in flight are reported as unconfirmed
+        zc_sender_finish(c->zc, 0);
+        snprintf(what, sizeof what, "server: finished sending data to client (fd: %d)", c->fd);
+        zc_print_stats(&c->zc->stats, what);
+        free(c->zc);
+        server_download_report(loop->cfg->results, c->fd, &c->tcp);
+    }
+    else if (c->entry)
+    {
+        rt_release(loop->cfg->results, c->entry, c->counter);
+    }
+
+    // close() also removes the fd from the epoll set
+    close(c->fd);
+    free(c);
+}
+
+static void loop_accept(event_loop_t *loop, el_listener_t *l)
+{
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t len = sizeof client_addr;
+        int fd = accept4(l->fd, (struct sockaddr *)&client_addr, &len, SOCK_NONBLOCK);
+        if (fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept4");
+            return;
+        }
+
+        el_conn_t *c = calloc(1, sizeof *c);
+        if (!c)
+        {
+            perror("calloc");
+            close(fd);
+            continue;
+        }
+        c->kind = EL_CONN;
+        c->fd = fd;
+        c->start = now_ts();
+        c->deadline = c->start;
+        c->deadline.tv_sec += loop->cfg->T;
+
+        struct epoll_event ev = {.data.ptr = c};
+        if (l->kind == EL_LISTEN_DOWN)
+        {
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof ip);
+            printf("server: download connection from %s (loop %d)\n", ip, loop->id);
+            c->zc = malloc(sizeof *c->zc);
+            if (!c->zc)
+            {
+                perror("malloc");
+                close(fd);
+                free(c);
+                continue;
+            }
+            zc_sender_init(c->zc, fd, loop->cfg->send_mode);
+            c->state = CONN_DOWNLOAD;
+            ev.events = EPOLLOUT;
+        }
+        else
+        {
+            discard_prepare_socket(&loop->sink, fd);
+            c->state = CONN_UPLOAD_HEADER;
+            ev.events = EPOLLIN | EPOLLRDHUP;
+        }
+
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            perror("epoll_ctl (conn)");
+            close(fd);
+            free(c->zc);
+            free(c);
+            continue;
+        }
+        conn_link(loop, c);
+    }
+}
+
+// Returns 0 to keep the connection, -1 to close it
+static int conn_on_download(el_conn_t *c, uint32_t events)
+{
+    if (events & EPOLLHUP)
+        return -1;
+    // MSG_ZEROCOPY completions wake us with EPOLLERR; a real socket error
+    // leaves nothing to reap and makes the send below fail
+    if (events & EPOLLERR)
+    {
+        if (c->zc->mode != ZC_MODE_MSG || zc_reap(c->zc) == 0)
+            return -1;
+    }
+
+    for (int i = 0; i < EL_SEND_BURST; i++)
+    {
+        if (zc_send(c->zc, MSG_NOSIGNAL) == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            if (errno == EPIPE || errno == ECONNRESET)
+                return -1; // the client ended the test early
+            perror("send in event loop");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int conn_on_upload(event_loop_t *loop, el_conn_t *c, const struct timespec *now)
+{
+    if (c->state == CONN_UPLOAD_HEADER)
+    {
+        ssize_t r = recv(c->fd, c->header + c->header_len, sizeof c->header - c->header_len, 0);
+        if (r == 0)
+            return -1;
+        if (r < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+        c->header_len += r;
+        if (c->header_len < sizeof c->header)
+            return 0;
+
+        uint8_t status = upload_claim_slot(loop->cfg->results, c->header, c->fd, &c->entry, &c->counter);
+        upload_send_status(c->fd, status);
+        if (status != UPLOAD_STATUS_OK)
+            return -1;
+        c->bytes = UPLOAD_HEADER_LEN;
+        c->state = CONN_UPLOAD_DATA;
+    }
+
+    uint64_t total = 0;
+    int closed = 0;
+    for (int i = 0; i < EL_RECV_BURST; i++)
+    {
+        ssize_t r = discard_recv(&loop->sink, c->fd, MSG_DONTWAIT);
+        if (r > 0)
+        {
+            total += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            closed = 1;
+        break;
+    }
+
+    if (total > 0)
+    {
+        c->bytes += total;
+        conn_counter_publish(c->counter, c->bytes, diff_ts(&c->start, now));
+    }
+    return closed ? -1 : 0;
+}
+
+static int loop_timeout_ms(event_loop_t *loop, const struct timespec *now)
+{
+    if (!loop->head)
+        return -1;
+    double left = diff_ts(now, &loop->head->deadline);
+    if (left <= 0)
+        return 0;
+    return (int)(left * 1000) + 1;
+}
+
+static void *loop_thread(void *arg)
+{
+    event_loop_t *loop = arg;
+    struct epoll_event events[EL_MAX_EVENTS];
+    struct timespec now = now_ts();
+
+    while (1)
+    {
+        int n = epoll_wait(loop->epfd, events, EL_MAX_EVENTS, loop_timeout_ms(loop, &now));
+        if (n == -1 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            break;
+        }
+        now = now_ts();
+
+        for (int i = 0; i < n; i++)
+        {
+            enum el_kind kind = *(enum el_kind *)events[i].data.ptr;
+            if (kind != EL_CONN)
+            {
+                loop_accept(loop, events[i].data.ptr);
+                continue;
+            }
+
+            el_conn_t *c = events[i].data.ptr;
+            tcpi_poll(c->fd, &c->tcp, diff_ts(&c->start, &now));
+            int rc;
+            if (!ts_before(&now, &c->deadline))
+                rc = -1;
+            else if (c->state == CONN_DOWNLOAD)
+                rc = conn_on_download(c, events[i].events);
+            else
+                rc = conn_on_upload(loop, c, &now);
+
+            if (rc < 0)
+                conn_close(loop, c);
+        }
+
+        // Expire connections only after the batch, so no pending event points to a freed conn
+        while (loop->head && !ts_before(&now, &loop->head->deadline))
+            conn_close(loop, loop->head);
+    }
+    return NULL;
+}
+
+static int loop_init(event_loop_t *loop, int id, const event_loop_cfg_t *cfg)
+{
+    memset(loop, 0, sizeof *loop);
+    loop->id = id;
+    loop->cfg = cfg;
+    loop->down = (el_listener_t){.kind = EL_LISTEN_DOWN, .fd = cfg->down_fds[id]};
+    loop->up = (el_listener_t){.kind = EL_LISTEN_UP, .fd = cfg->up_fds[id]};
+
+    if (discard_init(&loop->sink, cfg->recv_mode) < 0)
+        return -1;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1)
+    {
+        perror("epoll_create1");
+        discard_destroy(&loop->sink);
+        return -1;
+    }
+
+    // EPOLLEXCLUSIVE: a new connection on a shared listener wakes only one of the loops
+    el_listener_t *listeners[] = {&loop->down, &loop->up};
+    for (int i = 0; i < 2; i++)
+    {
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = listeners[i]};
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listeners[i]->fd, &ev) == -1)
+        {
+            perror("epoll_ctl (listener)");
+            close(loop->epfd);
+            discard_destroy(&loop->sink);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int event_loop_run(const event_loop_cfg_t *cfg)
+{
+    int n = cfg->n_loops > 0 ? cfg->n_loops : 1;
+
+    // accept4() is called until EAGAIN, so the listeners must not block
+    for (int i = 0; i < n; i++)
+    {
+        if (set_nonblocking(cfg->down_fds[i]) == -1 || set_nonblocking(cfg->up_fds[i]) == -1)
+        {
+            perror("fcntl O_NONBLOCK");
+            return -1;
+        }
+    }
+
+    event_loop_t *loops = calloc(n, sizeof *loops);
+    if (!loops)
+    {
+        perror("calloc");
+        return -1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (loop_init(&loops[i], i, cfg) < 0)
+            break;
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        int cpu = cfg->sharded ? cpu_by_index(i) : -1;
+        if (cpu >= 0 && thread_attr_pin(&attr, cpu) != 0)
+            fprintf(stderr, "event loop %d: cannot pin to CPU %d\n", i, cpu);
+
+        int rc = pthread_create(&loops[i].thr, &attr, loop_thread, &loops[i]);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            perror("pthread_create (event loop)");
+            close(loops[i].epfd);
+            discard_destroy(&loops[i].sink);
+            break;
+        }
+        started++;
+    }
+    printf("server: %d event loop(s) running%s\n", started,
+           cfg->sharded ? " (SO_REUSEPORT shards, pinned)" : "");
+
+    for (int i = 0; i < started; i++)
+        pthread_join(loops[i].thr, NULL);
+
+    free(loops);
+    return started == n ? 0 : -1;
+}
@@ -0,0 +1,37 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "common.h"
+#include "results_table.h"
+
+// Configuration shared by every event loop of the server
+typedef struct event_loop_cfg
+{
+    int n_loops;                  // Number of loops/threads (one per core)
+    const int *down_fds;          // Per-loop listening socket for downloads (TCP_PORT_DOWN)
+    const int *up_fds;            // Per-loop listening socket for uploads (TCP_PORT_UPLOAD)
+    int sharded;                  // Listeners are per-loop SO_REUSEPORT sockets; pin loop i to a CPU
+    int T;                        // Test duration in seconds
+    int send_mode;                // Download send path (ZC_MODE_*, epoll only), zc_init() already done
+    int recv_mode;                // Upload discard method (DISCARD_*, epoll only)
+    results_table_t *results;     // Upload results table
+} event_loop_cfg_t;
+
+/**
+ * @brief Runs the epoll-based server core.
+ *
+ * Starts cfg->n_loops threads, each with its own epoll instance watching its
+ * two listening sockets. Without sharding every loop gets the same pair and
+ * they share it with EPOLLEXCLUSIVE; with sharding each loop owns a
+ * SO_REUSEPORT pair, the kernel spreads connections among them and the loop
+ * thread is pinned to its own CPU (its connection state is allocated from
+ * that thread, so it stays NUMA-local). Download and upload connections are
+ * driven as non-blocking state machines instead of one thread per connection.
+ * Returns only once every loop has exited.
+ *
+ * @param cfg Listening sockets, duration and results table.
+ * @return int 0, or -1 if a loop failed to start.
+ */
+int event_loop_run(const event_loop_cfg_t *cfg);
+
+#endif // EVENT_LOOP_H
@@ -2,8 +2,10 @@
 #define HANDLE_RESULT_H
 
 #include <stdint.h>
+#include "series.h" /* For TS_SLOTS */
 
-#define NUM_CONN 10
+#define NUM_CONN 10   /* streams of the text format (and of older clients) */
+#define MAX_CONN 1024 /* streams a test may use */
 
 #define E_MINIMUM_DATA    -1
 #define E_NOT_ENOUGH_DATA -2
@@ -11,15 +13,98 @@
 #define E_LINE_TOO_LONG   -4
 #define E_INV_LINE_FORMAT -5
 #define E_NUMBER_PARSE    -6
+#define E_BAD_VERSION     -7
+
+/* Results formats. A 4-byte request (test_id) gets the text format; a
+ * 5-byte request (test_id + version) gets the binary format, in the highest
+ * version the server supports up to the one asked for. */
+#define RESULT_FMT_TEXT   0
+#define RESULT_FMT_BIN_V1 1 /* one datagram */
+#define RESULT_FMT_BIN_V2 2 /* one datagram per RESULT_CHUNK_CONNS streams */
+#define RESULT_FMT_BIN_V3 3 /* v2 + one series datagram per stream */
+#define RESULT_FMT_BIN_V4 4 /* v3 + the server's TCP_INFO of the test's download */
+#define RESULT_FMT_LATEST RESULT_FMT_BIN_V4
+
+/* Binary, little-endian, fixed layout:
+ *   0  u8  version       1  u8  kind (0)       2  u16 n_conn
+ *   4  u32 id_measurement
+ * v2 and later:
+ *   8  u16 first         10 u16 count          (streams in this datagram)
+ * then count (v1: n_conn) x { u64 bytes, u64 duration_ns }
+ *
+ * v3 adds, after the counters, one datagram per stream of kind 1:
+ *   8  u16 stream        10 u16 count          (intervals)
+ *   12 u32 first_interval 16 u16 interval_ms   18 u16 reserved (0)
+ *   20 count x u32 bytes received in the interval
+ *
+ * v4 adds, between the counters and the series, one datagram of kind 2:
+ *   8  u16 streams       10 u16 reserved (0)   12 u32 retrans
+ *   16 u64 busy_us       24 u64 rwnd_limited_us 32 u64 sndbuf_limited_us */
+#define RESULT_BIN_HDR_SIZE  8
+#define RESULT_CHUNK_HDR_SIZE 12
+#define RESULT_BIN_CONN_SIZE 16
+#define RESULT_BIN_SIZE(n)   (RESULT_BIN_HDR_SIZE + (n) * RESULT_BIN_CONN_SIZE)
+#define RESULT_CHUNK_CONNS   64 /* 1036-byte datagrams: no IP fragmentation */
+#define RESULT_CHUNK_SIZE(n) (RESULT_CHUNK_HDR_SIZE + (n) * RESULT_BIN_CONN_SIZE)
+#define RESULT_KIND_COUNTERS 0
+#define RESULT_KIND_SERIES   1
+#define RESULT_KIND_TCP      2
+#define RESULT_TCP_SIZE      40
+#define RESULT_SERIES_HDR_SIZE 20
+#define RESULT_SERIES_SIZE(n) (RESULT_SERIES_HDR_SIZE + (n) * 4)
+
+/* Throughput of one stream per interval_ms, from its own start */
+struct BW_series {
+  uint32_t first;            /* interval index of bytes[0] */
+  uint32_t count;            /* intervals in bytes[]; 0 if none were received */
+  uint32_t bytes[TS_SLOTS];
+};
+
+/* Sending side of the test's download, as the server saw it (v4): the
+ * TCP_INFO of every stream that carried the test id, merged */
+struct BW_tcp {
+  uint32_t streams;           /* 0: none reported (older server or client) */
+  uint32_t retrans;           /* segments retransmitted */
+  uint64_t busy_us;           /* time with data in flight */
+  uint64_t rwnd_limited_us;   /* ... stalled on the client's receive window */
+  uint64_t sndbuf_limited_us; /* ... stalled on the server's send buffer */
+};
 
 struct BW_result {
   uint32_t id_measurement;
-  uint64_t conn_bytes[NUM_CONN];
-  double conn_duration[NUM_CONN];
+  int n_conn;
+  uint64_t *conn_bytes;   /* n_conn entries, see initBwResult() */
+  double *conn_duration;
+  int interval_ms;        /* of the series */
+  struct BW_series *series;
+  struct BW_tcp download_tcp;
 };
 
+/* Allocates zeroed room for n_conn streams (1..MAX_CONN); 0 or -1 */
+int initBwResult(struct BW_result *bw_result, int n_conn);
+void freeBwResult(struct BW_result *bw_result);
+
 void printBwResult(struct BW_result bw_result);
+/* Text: n_conn lines; the unpacker expects bw_result->n_conn of them */
 int packResultPayload(struct BW_result bw_result, void *buffer, int buffer_size);
 int unpackResultPayload(struct BW_result *bw_result, void *buffer, int buffer_size);
+/* Binary: v1 packs every stream (first must be 0); v2 and later pack up to
+ * RESULT_CHUNK_CONNS of them starting at first. Returns bytes packed. */
+int packResultBinary(const struct BW_result *bw_result, int version, int first,
+                     void *buffer, int buffer_size);
+/* v3 series datagram of one stream */
+int packResultSeries(const struct BW_result *bw_result, int stream, void *buffer, int buffer_size);
+/* v4 datagram with bw_result->download_tcp */
+int packResultTcp(const struct BW_result *bw_result, void *buffer, int buffer_size);
+/* Fills the streams carried by one datagram of any version into a
+ * bw_result sized to at least the test's n_conn; returns how many, from
+ * *first. *kind tells counters from a series (always one stream) or the
+ * download's TCP_INFO (no stream: returns 0). */
+int unpackResultBinary(struct BW_result *bw_result, const void *buffer, int buffer_size,
+                       int *first, int *kind);
+/* Reads the id and n_conn of a reply in format without unpacking it, so a
+ * reply of another test is dropped before it touches anything. A text
+ * reply's n_conn is its number of lines. 0 or E_*. */
+int peekResult(const void *buffer, int buffer_size, int format, uint32_t *id, int *n_conn);
 
 #endif /* HANDLE_RESULT_H */
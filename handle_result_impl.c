@@ -1,3 +1,5 @@
+#define _DEFAULT_SOURCE /* htole16() & co. in <endian.h> */
+
 #ifdef __APPLE__
 #include <machine/endian.h>
 #include <libkern/OSByteOrder.h>
@@ -27,9 +29,36 @@
 #include <errno.h>
 #include "handle_result.h"
 
+int initBwResult(struct BW_result *bw_result, int n_conn) {
+  memset(bw_result, 0, sizeof(*bw_result));
+  if (n_conn < 1 || n_conn > MAX_CONN) {
+    return -1;
+  }
+  bw_result->conn_bytes = calloc(n_conn, sizeof(*bw_result->conn_bytes));
+  bw_result->conn_duration = calloc(n_conn, sizeof(*bw_result->conn_duration));
+  bw_result->series = calloc(n_conn, sizeof(*bw_result->series));
+  if (!bw_result->conn_bytes || !bw_result->conn_duration || !bw_result->series) {
+    freeBwResult(bw_result);
+    return -1;
+  }
+  bw_result->n_conn = n_conn;
+  bw_result->interval_ms = TS_INTERVAL_MS;
+  return 0;
+}
+
+void freeBwResult(struct BW_result *bw_result) {
+  free(bw_result->conn_bytes);
+  free(bw_result->conn_duration);
+  free(bw_result->series);
+  bw_result->conn_bytes = NULL;
+  bw_result->conn_duration = NULL;
+  bw_result->series = NULL;
+  bw_result->n_conn = 0;
+}
+
 void printBwResult(struct BW_result bw_result) {
   printf("id 0x%x\n", bw_result.id_measurement);
-  for (int i = 0; i < NUM_CONN; i++) {
+  for (int i = 0; i < bw_result.n_conn; i++) {
     printf("conn %2d  %20llu bytes %.3f seconds\n", i, 
            (unsigned long long)bw_result.conn_bytes[i], 
            bw_result.conn_duration[i]);
@@ -37,37 +66,34 @@ void printBwResult(struct BW_result bw_result) {
 }
 
 int packResultPayload(struct BW_result bw_result, void *buffer, int buffer_size) {
-  int bytes_temp_buffer = 0;
-  char my_buffer[500];
-  memset(my_buffer, 0, sizeof(my_buffer));
-  
+  char *buf = (char *)buffer;
+  int bytes_packed = 0;
+
   // Pack id
   uint32_t netorder_id = htonl(bw_result.id_measurement);
-  memcpy(my_buffer, &netorder_id, sizeof(netorder_id));
-  bytes_temp_buffer += sizeof(netorder_id);
+  if ((size_t)buffer_size < sizeof(netorder_id)) {
+    /* Not enough buffer space */
+    return -1;
+  }
+  memcpy(buf, &netorder_id, sizeof(netorder_id));
+  bytes_packed += sizeof(netorder_id);
 
   // Pack each connection measurement
-  for (int i = 0; i < NUM_CONN; i++) {
-    char aux[20];
+  for (int i = 0; i < bw_result.n_conn; i++) {
+    char aux[40];
     int  n_aux;
-    memset(aux, 0, sizeof(aux));
-    n_aux = sprintf(aux, "%llu,%.3f\n", 
-                   (unsigned long long)bw_result.conn_bytes[i], 
-                   bw_result.conn_duration[i]);
-    memcpy(my_buffer+bytes_temp_buffer, aux, n_aux);
-    bytes_temp_buffer += n_aux;
-  }
-  
-  if (buffer_size >= bytes_temp_buffer) {
-    /* Copy results to buffer given */
-    memcpy(buffer, my_buffer, bytes_temp_buffer);
-  }
-  else {
-    /* Not enough buffer space */
-    return -1;
+    n_aux = snprintf(aux, sizeof(aux), "%llu,%.3f\n",
+                     (unsigned long long)bw_result.conn_bytes[i], 
+                     bw_result.conn_duration[i]);
+    if (n_aux < 0 || (size_t)n_aux >= sizeof(aux) || bytes_packed + n_aux > buffer_size) {
+      /* Not enough buffer space */
+      return -1;
+    }
+    memcpy(buf + bytes_packed, aux, n_aux);
+    bytes_packed += n_aux;
   }
 
-  return bytes_temp_buffer;
+  return bytes_packed;
 }
 
 int unpackResultPayload(struct BW_result *bw_result, void *buffer, int buffer_size) {
@@ -86,7 +112,7 @@ int unpackResultPayload(struct BW_result *bw_result, void *buffer, int buffer_si
   offset += sizeof(netorder_id);
 
   // Unpack each connection measurement
-  for (int i = 0; i < NUM_CONN; i++) {
+  for (int i = 0; i < bw_result->n_conn; i++) {
     if (offset >= buffer_size) {
       /* Not enough data */
       return E_NOT_ENOUGH_DATA; 
@@ -148,3 +174,259 @@ int unpackResultPayload(struct BW_result *bw_result, void *buffer, int buffer_si
   
   return offset; // Return total bytes consumed
 }
+
+int packResultBinary(const struct BW_result *bw_result, int version, int first,
+                     void *buffer, int buffer_size) {
+  int count, hdr_size;
+  if (version == RESULT_FMT_BIN_V1 && first == 0) {
+    count = bw_result->n_conn;
+    hdr_size = RESULT_BIN_HDR_SIZE;
+  } else if (version >= RESULT_FMT_BIN_V2 && version <= RESULT_FMT_BIN_V4 &&
+             first >= 0 && first < bw_result->n_conn) {
+    count = bw_result->n_conn - first;
+    if (count > RESULT_CHUNK_CONNS) {
+      count = RESULT_CHUNK_CONNS;
+    }
+    hdr_size = RESULT_CHUNK_HDR_SIZE;
+  } else {
+    return -1;
+  }
+  int size = version == RESULT_FMT_BIN_V1 ? RESULT_BIN_SIZE(count) : RESULT_CHUNK_SIZE(count);
+  if (buffer_size < size) {
+    return -1;
+  }
+
+  uint8_t *buf = (uint8_t *)buffer;
+  uint16_t n_conn = htole16(bw_result->n_conn);
+  uint32_t id = htole32(bw_result->id_measurement);
+  buf[0] = version;
+  buf[1] = RESULT_KIND_COUNTERS;
+  memcpy(buf + 2, &n_conn, sizeof(n_conn));
+  memcpy(buf + 4, &id, sizeof(id));
+  if (version != RESULT_FMT_BIN_V1) {
+    uint16_t le_first = htole16(first), le_count = htole16(count);
+    memcpy(buf + 8, &le_first, sizeof(le_first));
+    memcpy(buf + 10, &le_count, sizeof(le_count));
+  }
+
+  uint8_t *p = buf + hdr_size;
+  for (int i = first; i < first + count; i++, p += RESULT_BIN_CONN_SIZE) {
+    uint64_t bytes = htole64(bw_result->conn_bytes[i]);
+    uint64_t ns = htole64((uint64_t)(bw_result->conn_duration[i] * 1e9 + 0.5));
+    memcpy(p, &bytes, sizeof(bytes));
+    memcpy(p + 8, &ns, sizeof(ns));
+  }
+  return size;
+}
+
+int packResultSeries(const struct BW_result *bw_result, int stream, void *buffer, int buffer_size) {
+  if (stream < 0 || stream >= bw_result->n_conn) {
+    return -1;
+  }
+  const struct BW_series *series = &bw_result->series[stream];
+  int size = RESULT_SERIES_SIZE(series->count);
+  if (series->count > TS_SLOTS || buffer_size < size) {
+    return -1;
+  }
+
+  uint8_t *buf = (uint8_t *)buffer;
+  uint16_t n_conn = htole16(bw_result->n_conn);
+  uint32_t id = htole32(bw_result->id_measurement);
+  uint16_t le_stream = htole16(stream), le_count = htole16(series->count);
+  uint32_t le_first = htole32(series->first);
+  uint16_t le_interval = htole16(bw_result->interval_ms), reserved = 0;
+  buf[0] = RESULT_FMT_BIN_V3;
+  buf[1] = RESULT_KIND_SERIES;
+  memcpy(buf + 2, &n_conn, sizeof(n_conn));
+  memcpy(buf + 4, &id, sizeof(id));
+  memcpy(buf + 8, &le_stream, sizeof(le_stream));
+  memcpy(buf + 10, &le_count, sizeof(le_count));
+  memcpy(buf + 12, &le_first, sizeof(le_first));
+  memcpy(buf + 16, &le_interval, sizeof(le_interval));
+  memcpy(buf + 18, &reserved, sizeof(reserved));
+
+  uint8_t *p = buf + RESULT_SERIES_HDR_SIZE;
+  for (uint32_t i = 0; i < series->count; i++, p += 4) {
+    uint32_t bytes = htole32(series->bytes[i]);
+    memcpy(p, &bytes, sizeof(bytes));
+  }
+  return size;
+}
+
+static int unpackResultSeries(struct BW_result *bw_result, const uint8_t *buf, int buffer_size,
+                              int *first) {
+  if (buffer_size < RESULT_SERIES_HDR_SIZE) {
+    return E_MINIMUM_DATA;
+  }
+  uint16_t le_stream, le_count, le_interval;
+  uint32_t le_first, id;
+  memcpy(&id, buf + 4, sizeof(id));
+  memcpy(&le_stream, buf + 8, sizeof(le_stream));
+  memcpy(&le_count, buf + 10, sizeof(le_count));
+  memcpy(&le_first, buf + 12, sizeof(le_first));
+  memcpy(&le_interval, buf + 16, sizeof(le_interval));
+  int stream = le16toh(le_stream), count = le16toh(le_count);
+  if (stream >= bw_result->n_conn || count > TS_SLOTS) {
+    return E_INV_LINE_FORMAT;
+  }
+  if (buffer_size < RESULT_SERIES_SIZE(count)) {
+    return E_NOT_ENOUGH_DATA;
+  }
+  bw_result->id_measurement = le32toh(id);
+  bw_result->interval_ms = le16toh(le_interval);
+
+  struct BW_series *series = &bw_result->series[stream];
+  series->first = le32toh(le_first);
+  series->count = count;
+  const uint8_t *p = buf + RESULT_SERIES_HDR_SIZE;
+  for (int i = 0; i < count; i++, p += 4) {
+    uint32_t bytes;
+    memcpy(&bytes, p, sizeof(bytes));
+    series->bytes[i] = le32toh(bytes);
+  }
+  *first = stream;
+  return 1;
+}
+
+int packResultTcp(const struct BW_result *bw_result, void *buffer, int buffer_size) {
+  if (buffer_size < RESULT_TCP_SIZE) {
+    return -1;
+  }
+  const struct BW_tcp *tcp = &bw_result->download_tcp;
+  uint8_t *buf = (uint8_t *)buffer;
+  uint16_t n_conn = htole16(bw_result->n_conn);
+  uint32_t id = htole32(bw_result->id_measurement);
+  uint16_t streams = htole16(tcp->streams > UINT16_MAX ? UINT16_MAX : tcp->streams), reserved = 0;
+  uint32_t retrans = htole32(tcp->retrans);
+  uint64_t busy = htole64(tcp->busy_us), rwnd = htole64(tcp->rwnd_limited_us),
+           sndbuf = htole64(tcp->sndbuf_limited_us);
+  buf[0] = RESULT_FMT_BIN_V4;
+  buf[1] = RESULT_KIND_TCP;
+  memcpy(buf + 2, &n_conn, sizeof(n_conn));
+  memcpy(buf + 4, &id, sizeof(id));
+  memcpy(buf + 8, &streams, sizeof(streams));
+  memcpy(buf + 10, &reserved, sizeof(reserved));
+  memcpy(buf + 12, &retrans, sizeof(retrans));
+  memcpy(buf + 16, &busy, sizeof(busy));
+  memcpy(buf + 24, &rwnd, sizeof(rwnd));
+  memcpy(buf + 32, &sndbuf, sizeof(sndbuf));
+  return RESULT_TCP_SIZE;
+}
+
+static int unpackResultTcp(struct BW_result *bw_result, const uint8_t *buf, int buffer_size, int *first) {
+  if (buffer_size < RESULT_TCP_SIZE) {
+    return E_NOT_ENOUGH_DATA;
+  }
+  uint16_t streams;
+  uint32_t id, retrans;
+  uint64_t busy, rwnd, sndbuf;
+  memcpy(&id, buf + 4, sizeof(id));
+  memcpy(&streams, buf + 8, sizeof(streams));
+  memcpy(&retrans, buf + 12, sizeof(retrans));
+  memcpy(&busy, buf + 16, sizeof(busy));
+  memcpy(&rwnd, buf + 24, sizeof(rwnd));
+  memcpy(&sndbuf, buf + 32, sizeof(sndbuf));
+  bw_result->id_measurement = le32toh(id);
+  bw_result->download_tcp.streams = le16toh(streams);
+  bw_result->download_tcp.retrans = le32toh(retrans);
+  bw_result->download_tcp.busy_us = le64toh(busy);
+  bw_result->download_tcp.rwnd_limited_us = le64toh(rwnd);
+  bw_result->download_tcp.sndbuf_limited_us = le64toh(sndbuf);
+  *first = 0;
+  return 0;
+}
+
+int unpackResultBinary(struct BW_result *bw_result, const void *buffer, int buffer_size,
+                       int *first, int *kind) {
+  if (buffer_size < RESULT_BIN_HDR_SIZE) {
+    return E_MINIMUM_DATA;
+  }
+
+  const uint8_t *buf = (const uint8_t *)buffer;
+  int version = buf[0];
+  if (version < RESULT_FMT_BIN_V1 || version > RESULT_FMT_BIN_V4) {
+    return E_BAD_VERSION;
+  }
+  *kind = version >= RESULT_FMT_BIN_V3 ? buf[1] : RESULT_KIND_COUNTERS;
+  if (*kind != RESULT_KIND_COUNTERS && *kind != RESULT_KIND_SERIES &&
+      (*kind != RESULT_KIND_TCP || version < RESULT_FMT_BIN_V4)) {
+    return E_INV_LINE_FORMAT;
+  }
+  uint16_t n_conn;
+  uint32_t id;
+  memcpy(&n_conn, buf + 2, sizeof(n_conn));
+  memcpy(&id, buf + 4, sizeof(id));
+  n_conn = le16toh(n_conn);
+  if (n_conn > bw_result->n_conn) {
+    return E_INV_LINE_FORMAT;
+  }
+  if (*kind == RESULT_KIND_SERIES) {
+    return unpackResultSeries(bw_result, buf, buffer_size, first);
+  }
+  if (*kind == RESULT_KIND_TCP) {
+    return unpackResultTcp(bw_result, buf, buffer_size, first);
+  }
+
+  int hdr_size = RESULT_BIN_HDR_SIZE, start = 0, count = n_conn;
+  if (version != RESULT_FMT_BIN_V1) {
+    if (buffer_size < RESULT_CHUNK_HDR_SIZE) {
+      return E_MINIMUM_DATA;
+    }
+    uint16_t le_first, le_count;
+    memcpy(&le_first, buf + 8, sizeof(le_first));
+    memcpy(&le_count, buf + 10, sizeof(le_count));
+    start = le16toh(le_first);
+    count = le16toh(le_count);
+    if (start + count > n_conn) {
+      return E_INV_LINE_FORMAT;
+    }
+    hdr_size = RESULT_CHUNK_HDR_SIZE;
+  }
+  if (buffer_size < hdr_size + count * RESULT_BIN_CONN_SIZE) {
+    return E_NOT_ENOUGH_DATA;
+  }
+  bw_result->id_measurement = le32toh(id);
+
+  const uint8_t *p = buf + hdr_size;
+  for (int i = start; i < start + count; i++, p += RESULT_BIN_CONN_SIZE) {
+    uint64_t bytes, ns;
+    memcpy(&bytes, p, sizeof(bytes));
+    memcpy(&ns, p + 8, sizeof(ns));
+    bw_result->conn_bytes[i] = le64toh(bytes);
+    bw_result->conn_duration[i] = le64toh(ns) / 1e9;
+  }
+  *first = start;
+  return count;
+}
+
+int peekResult(const void *buffer, int buffer_size, int format, uint32_t *id, int *n_conn) {
+  const uint8_t *buf = (const uint8_t *)buffer;
+  if (format == RESULT_FMT_TEXT) {
+    uint32_t netorder_id;
+    if ((size_t)buffer_size < sizeof(netorder_id)) {
+      return E_MINIMUM_DATA;
+    }
+    memcpy(&netorder_id, buf, sizeof(netorder_id));
+    *id = ntohl(netorder_id);
+    int lines = 0;
+    for (int i = sizeof(netorder_id); i < buffer_size; i++) {
+      lines += buf[i] == '\n';
+    }
+    *n_conn = lines;
+    return 0;
+  }
+
+  if (buffer_size < RESULT_BIN_HDR_SIZE) {
+    return E_MINIMUM_DATA;
+  }
+  if (buf[0] < RESULT_FMT_BIN_V1 || buf[0] > RESULT_FMT_BIN_V4) {
+    return E_BAD_VERSION;
+  }
+  uint16_t le_n_conn;
+  uint32_t le_id;
+  memcpy(&le_n_conn, buf + 2, sizeof(le_n_conn));
+  memcpy(&le_id, buf + 4, sizeof(le_id));
+  *id = le32toh(le_id);
+  *n_conn = le16toh(le_n_conn);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include "histogram.h"
+#include <string.h>
+
+#define HIST_MAX_VALUE ((1ULL << HIST_MAX_BITS) - 1)
+
+// Bucket of v: the top HIST_SUB_BITS bits of v, offset by its magnitude
+static unsigned bucket_of(uint64_t v)
+{
+    if (v < 2 * HIST_HALF)
+        return (unsigned)v;
+    unsigned shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+    return shift * HIST_HALF + (unsigned)(v >> shift);
+}
+
+// Largest value that falls in bucket i
+static uint64_t bucket_top(unsigned i)
+{
+    if (i < 2 * HIST_HALF)
+        return i;
+    unsigned shift = i / HIST_HALF - 1;
+    return ((uint64_t)(i - shift * HIST_HALF) << shift) + (1ULL << shift) - 1;
+}
+
+void hist_init(lat_hist_t *h)
+{
+    memset(h, 0, sizeof *h);
+}
+
+void hist_record(lat_hist_t *h, uint64_t ns)
+{
+    if (h->count == 0 || ns < h->min_ns)
+        h->min_ns = ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > HIST_MAX_VALUE)
+    {
+        h->clamped++;
+        ns = HIST_MAX_VALUE;
+    }
+    h->buckets[bucket_of(ns)]++;
+}
+
+void hist_merge(lat_hist_t *dst, const lat_hist_t *src)
+{
+    if (src->count == 0)
+        return;
+    if (dst->count == 0 || src->min_ns < dst->min_ns)
+        dst->min_ns = src->min_ns;
+    if (src->max_ns > dst->max_ns)
+        dst->max_ns = src->max_ns;
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    dst->clamped += src->clamped;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t hist_percentile(const lat_hist_t *h, double p)
+{
+    if (h->count == 0)
+        return 0;
+    if (p <= 0)
+        return h->min_ns;
+    // Rank of the value, 1-based: p99.9 of 1000 values is the 999th
+    uint64_t rank = (uint64_t)(p * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank >= h->count)
+        return h->max_ns;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t v = bucket_top(i);
+            return v < h->min_ns ? h->min_ns : v > h->max_ns ? h->max_ns : v;
+        }
+    }
+    return h->max_ns;
+}
+
+double hist_mean(const lat_hist_t *h)
+{
+    return h->count ? (double)h->sum_ns / h->count : 0.0;
+}
@@ -0,0 +1,55 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 8                        // 128 linear buckets per power of two: under 0.8% error
+#define HIST_HALF (1u << (HIST_SUB_BITS - 1))
+#define HIST_MAX_BITS 36                       // values up to 2^36 ns (68 s); larger ones are clamped
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_HALF)
+
+/**
+ * @brief Log-linear latency histogram, HDR style, in fixed memory.
+ *
+ * Values below 2^HIST_SUB_BITS ns get one bucket each; above that every
+ * power of two is split into HIST_HALF equal buckets, so the relative error
+ * is the same from microseconds to seconds. Recording is O(1) and two
+ * histograms merge by adding their buckets.
+ *
+ * One writer at a time; read it once the writer is done.
+ */
+typedef struct lat_hist
+{
+    uint64_t count;
+    uint64_t sum_ns;  // for the exact mean
+    uint64_t min_ns;  // exact, not bucketed
+    uint64_t max_ns;
+    uint64_t clamped; // values above 2^HIST_MAX_BITS, counted in the last bucket
+    uint32_t buckets[HIST_BUCKETS];
+} lat_hist_t;
+
+void hist_init(lat_hist_t *h);
+
+/**
+ * @brief Adds one value.
+ *
+ * @param ns Latency in nanoseconds.
+ */
+void hist_record(lat_hist_t *h, uint64_t ns);
+
+// Adds every value of src to dst
+void hist_merge(lat_hist_t *dst, const lat_hist_t *src);
+
+/**
+ * @brief Value at or below which a fraction p of the recorded values fall.
+ *
+ * @param p Between 0 and 1, e.g. 0.999 for p99.9.
+ * @return uint64_t Highest value of the bucket holding that rank, within
+ *         [min_ns, max_ns]; 0 if the histogram is empty.
+ */
+uint64_t hist_percentile(const lat_hist_t *h, double p);
+
+// Mean in nanoseconds, 0 if empty
+double hist_mean(const lat_hist_t *h);
+
+#endif // HISTOGRAM_H
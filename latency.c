@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // For recvmmsg, sendmmsg
+
 #include "common.h"
 #include <arpa/inet.h>
 #include <stdint.h>
@@ -8,171 +10,614 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 #include "latency.h"
 #include "handle_result.h"
 
-int send_results_udp(int sockfd, uint8_t *resp, results_lock_t *results_lock,
+// format: RESULT_FMT_TEXT o la versión binaria pedida por el cliente
+int send_results_udp(int sockfd, uint8_t *resp, int format, results_table_t *results,
                      struct sockaddr_in client_addr, socklen_t client_addr_len)
 {
-    pthread_mutex_lock(&results_lock->mutex);
-    struct BW_result *bw_results = results_lock->results;
-    for (int i = 0; i < MAX_CLIENTS; i++)
+    // Lee el test de la tabla (O(1)); los contadores se leen con acquire.
+    // Queda RT_TAKEN_TTL segundos más: un pedido repetido también se responde
+    uint32_t test_id;
+    memcpy(&test_id, resp, sizeof(test_id)); // mismos bytes que el header de subida
+    struct BW_result result;
+    if (rt_take(results, test_id, &result) < 0)
+    {
+        return 0; // Test desconocido o ya descartado
+    }
+
+    // Empaqueta el resultado: texto y v1 en un datagrama, v2 en uno cada
+    // RESULT_CHUNK_CONNS conexiones (el cliente los reordena); v3 agrega
+    // la serie de cada conexión en su propio datagrama, v4 el resumen de
+    // las descargas antes de las series
+    uint8_t buff[MAX_PAYLOAD];
+    int ret = 0;
+    for (int first = 0; first < result.n_conn; first += RESULT_CHUNK_CONNS)
     {
-        uint32_t net_resp;
-        memcpy(&net_resp, resp, sizeof(net_resp)); // pull the 4 bytes into a uint32_t
-        uint32_t resp_id = ntohl(net_resp);        // convert from network (big-endian) into host order
-        if (ntohl(bw_results[i].id_measurement) == resp_id)
+        int bytes_packed = format == RESULT_FMT_TEXT
+                               ? packResultPayload(result, buff, sizeof(buff))
+                               : packResultBinary(&result, format, first, buff, sizeof(buff));
+        if (bytes_packed < 0)
         {
-            // Empaqueta el resultado en el buffer de respuesta
-            uint8_t buff[MAX_PAYLOAD];
-            int bytes_packed = packResultPayload(bw_results[i], buff, sizeof(buff));
-            if (bytes_packed < 0)
-            {
-                fprintf(stderr, "Error packing result payload\n");
-                pthread_mutex_unlock(&results_lock->mutex);
-                return -1;
-            }
+            fprintf(stderr, "Error packing result payload (%d connections)\n", result.n_conn);
+            ret = -1;
+            break;
+        }
 
-            // Envía el resultado empaquetado al cliente
-            if (sendto(sockfd, buff, bytes_packed, 0, (struct sockaddr *)&client_addr, client_addr_len) < 0)
-            {
-                perror("sendto result");
-                pthread_mutex_unlock(&results_lock->mutex);
-                return -1;
-            }
+        // Envía el resultado empaquetado al cliente
+        if (sendto(sockfd, buff, bytes_packed, 0, (struct sockaddr *)&client_addr, client_addr_len) < 0)
+        {
+            perror("sendto result");
+            ret = -1;
+            break;
+        }
+        if (format == RESULT_FMT_TEXT || format == RESULT_FMT_BIN_V1)
+            break;
+    }
+    // v4: el resumen TCP_INFO de las descargas que el servidor envió para este test
+    if (ret == 0 && format >= RESULT_FMT_BIN_V4)
+    {
+        int bytes_packed = packResultTcp(&result, buff, sizeof(buff));
+        if (bytes_packed < 0 ||
+            sendto(sockfd, buff, bytes_packed, 0, (struct sockaddr *)&client_addr, client_addr_len) < 0)
+        {
+            perror("sendto download summary");
+            ret = -1;
+        }
+    }
+    for (int c = 0; ret == 0 && format >= RESULT_FMT_BIN_V3 && c < result.n_conn; c++)
+    {
+        int bytes_packed = packResultSeries(&result, c, buff, sizeof(buff));
+        if (bytes_packed < 0)
+        {
+            fprintf(stderr, "Error packing series of connection %d\n", c + 1);
+            ret = -1;
+        }
+        else if (sendto(sockfd, buff, bytes_packed, 0, (struct sockaddr *)&client_addr, client_addr_len) < 0)
+        {
+            perror("sendto series");
+            ret = -1;
+        }
+    }
+    freeBwResult(&result);
+    if (ret < 0)
+        return ret;
+
+    printf("Sent result for measurement ID 0x%02X%02X%02X%02X to %s:%d\n",
+           resp[0], resp[1], resp[2], resp[3],
+           inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    return 0; // Retorna 0 para indicar éxito
+}
+
+// Buffers de un hilo de eco, reservados una vez: recvmmsg() llena hasta
+// batch datagramas por llamada y sendmmsg() devuelve los ecos juntos
+typedef struct echo_batch
+{
+    struct mmsghdr in[LAT_BATCH];
+    struct mmsghdr out[LAT_BATCH];
+    struct iovec iov[LAT_BATCH];
+    struct sockaddr_in addr[LAT_BATCH];
+    uint8_t buf[LAT_BATCH][LAT_MAX_REQUEST];
+} echo_batch_t;
 
-            printf("Sent result for measurement ID 0x%02X%02X%02X%02X to %s:%d\n",
-                   resp[0], resp[1], resp[2], resp[3],
-                   inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+static void echo_batch_init(echo_batch_t *b)
+{
+    memset(b, 0, sizeof *b);
+    for (int i = 0; i < LAT_BATCH; i++)
+    {
+        b->iov[i].iov_base = b->buf[i];
+        b->iov[i].iov_len = sizeof b->buf[i];
+        b->in[i].msg_hdr.msg_iov = &b->iov[i];
+        b->in[i].msg_hdr.msg_iovlen = 1;
+        b->in[i].msg_hdr.msg_name = &b->addr[i];
+    }
+}
 
-            memset(&bw_results[i], 0, sizeof(bw_results[i]));
+// Envía los n ecos pendientes; un error descarta el datagrama que lo causó
+static void echo_flush(int sockfd, struct mmsghdr *out, int n)
+{
+    for (int sent = 0; sent < n;)
+    {
+        int r = sendmmsg(sockfd, out + sent, n - sent, 0);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("sendmmsg");
+            r = 1;
         }
+        sent += r;
+    }
+}
+
+static void put_realtime_be(uint8_t *p)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    uint64_t be = htobe64((uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec);
+    memcpy(p, &be, sizeof be);
+}
+
+// Contesta los n datagramas recibidos en b: los ecos salen primero y juntos,
+// los pedidos de resultados después. Devuelve los ecos enviados.
+static int echo_batch_serve(int sockfd, echo_batch_t *b, int n, results_table_t *results)
+{
+    // Un sello por lote: todos llegaron en el mismo recvmmsg()
+    uint8_t rx_stamp[8];
+    put_realtime_be(rx_stamp);
+    int n_out = 0, n_stamped = 0;
+    uint8_t *stamped[LAT_BATCH];
+    for (int i = 0; i < n; i++)
+    {
+        uint8_t *resp = b->buf[i];
+        unsigned r = b->in[i].msg_len;
+        // Eco: desde 4 bytes con 0xff (las sondas llevan seq y hora de envío);
+        // resultados: test_id (texto) o test_id + versión (binario)
+        if (resp[0] != 0xff || r < LAT_PAYLOAD_SIZE || (b->in[i].msg_hdr.msg_flags & MSG_TRUNC))
+            continue; // Ignora paquetes inválidos y pedidos de resultados
+
+        // Las sondas con sellos llevan la hora de llegada y la de salida
+        if (r == LAT_PROBE_SIZE && resp[1] == LAT_PROBE_VERSION)
+        {
+            memcpy(resp + LAT_PROBE_SERVER_RX, rx_stamp, sizeof rx_stamp);
+            stamped[n_stamped++] = resp;
+        }
+
+        // Responde con el mismo paquete recibido, desde el mismo buffer
+        struct msghdr *h = &b->out[n_out++].msg_hdr;
+        b->iov[i].iov_len = r;
+        h->msg_iov = &b->iov[i];
+        h->msg_iovlen = 1;
+        h->msg_name = &b->addr[i];
+        h->msg_namelen = b->in[i].msg_hdr.msg_namelen;
+    }
+    if (n_stamped)
+    {
+        uint8_t tx_stamp[8];
+        put_realtime_be(tx_stamp);
+        for (int i = 0; i < n_stamped; i++)
+            memcpy(stamped[i] + LAT_PROBE_SERVER_TX, tx_stamp, sizeof tx_stamp);
+    }
+    echo_flush(sockfd, b->out, n_out);
+
+    for (int i = 0; i < n; i++)
+    {
+        uint8_t *resp = b->buf[i];
+        unsigned r = b->in[i].msg_len;
+        b->iov[i].iov_len = sizeof b->buf[i];
+        if (resp[0] == 0xff || (r != LAT_PAYLOAD_SIZE && r != LAT_PAYLOAD_SIZE + 1))
+            continue;
+
+        // Enviar resultados de Upload si el primer byte no es 0xff
+        int format = RESULT_FMT_TEXT;
+        if (r == LAT_PAYLOAD_SIZE + 1)
+            format = resp[LAT_PAYLOAD_SIZE] < RESULT_FMT_LATEST ? resp[LAT_PAYLOAD_SIZE] : RESULT_FMT_LATEST;
+        if (send_results_udp(sockfd, resp, format, results, b->addr[i], b->in[i].msg_hdr.msg_namelen) < 0)
+        {
+            fprintf(stderr, "Error sending results\n");
+        }
+    }
+    return n_out;
+}
+
+// Tiempo entre que recvmmsg() devuelve un lote y sendmmsg() despacha sus ecos
+typedef struct echo_turnaround
+{
+    uint64_t packets;
+    double sum, min, max; // segundos por lote
+    uint64_t batches;
+} echo_turnaround_t;
+
+static void turnaround_add(echo_turnaround_t *t, double d, int packets)
+{
+    if (t->batches == 0 || d < t->min)
+        t->min = d;
+    if (d > t->max)
+        t->max = d;
+    t->sum += d;
+    t->batches++;
+    t->packets += packets;
+}
+
+// Imprime y reinicia las estadísticas cada LAT_REPORT_S
+static void turnaround_report(echo_turnaround_t *t, struct timespec *last_report, const struct timespec *now)
+{
+    if (t->packets == 0 || diff_ts(last_report, now) < LAT_REPORT_S)
+        return;
+    printf("server: busy-poll echo: %llu packets in %llu batches, turnaround "
+           "min/avg/max %.1f/%.1f/%.1f us\n",
+           (unsigned long long)t->packets, (unsigned long long)t->batches,
+           t->min * 1e6, t->sum / t->batches * 1e6, t->max * 1e6);
+    memset(t, 0, sizeof *t);
+    *last_report = *now;
+}
+
+// Modo busy-poll: el hilo (fijado a una CPU propia si hay) nunca duerme.
+// SO_BUSY_POLL hace que el kernel sondee la cola del driver dentro de la
+// llamada; sin permisos para activarlo igual se gira sobre el socket no
+// bloqueante. Las estadísticas salen cada LAT_REPORT_S, haya carga o no.
+static void echo_busy_poll(int sockfd, echo_batch_t *b, int batch, results_table_t *results)
+{
+    const int busy_us = LAT_BUSY_POLL_US;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_us, sizeof busy_us) == -1)
+        perror("server: SO_BUSY_POLL (spinning in user space only)");
+
+    echo_turnaround_t t = {0};
+    struct timespec last_report = now_ts();
+    while (1)
+    {
+        for (int i = 0; i < batch; i++)
+            b->in[i].msg_hdr.msg_namelen = sizeof b->addr[i];
+
+        int n = recvmmsg(sockfd, b->in, batch, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+        {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("recvmmsg");
+            struct timespec now = now_ts();
+            turnaround_report(&t, &last_report, &now);
+            continue;
+        }
+
+        struct timespec rx = now_ts();
+        int echoed = echo_batch_serve(sockfd, b, n, results);
+        struct timespec tx = now_ts();
+        if (echoed > 0)
+            turnaround_add(&t, diff_ts(&rx, &tx), echoed);
+        turnaround_report(&t, &last_report, &tx); // también bajo carga continua
     }
-    pthread_mutex_unlock(&results_lock->mutex);
-    return 0; // Retorna 0 para indicar éxito
 }
 
 void *latency_echo_server(void *args)
 {
     echo_server_args_t *echo_args = (echo_server_args_t *)args;
-    results_lock_t *results_lock = echo_args->results_lock;
+    results_table_t *results = echo_args->results;
+    int port = echo_args->port ? echo_args->port : UDP_SERVER_PORT;
+    int batch = echo_args->batch > 0 && echo_args->batch <= LAT_BATCH ? echo_args->batch : LAT_BATCH;
 
-    printf("server: UDP latency service on port %d …\n", UDP_SERVER_PORT);
-    struct sockaddr_in srv_addr, client_addr;
-    socklen_t addr_len = sizeof(srv_addr), client_addr_len = sizeof(client_addr);
-    int sockfd = udp_socket_init(NULL, UDP_SERVER_PORT, &srv_addr, 1);
+    printf("server: UDP latency service on port %d (batches of %d%s) …\n", port, batch,
+           echo_args->busy_poll ? ", busy-poll" : "");
+    struct sockaddr_in srv_addr;
+    int sockfd = udp_socket_init(NULL, port, &srv_addr,
+                                 UDP_SOCK_BIND | (echo_args->reuseport ? UDP_SOCK_REUSEPORT : 0));
     if (sockfd < 0)
     {
         fprintf(stderr, "Error initializing UDP socket\n");
         return NULL;
     }
 
-    uint8_t resp[LAT_PAYLOAD_SIZE];
+    echo_batch_t *b = malloc(sizeof *b);
+    if (!b)
+    {
+        perror("malloc (echo batch)");
+        close(sockfd);
+        return NULL;
+    }
+    echo_batch_init(b);
+
+    if (echo_args->busy_poll)
+        echo_busy_poll(sockfd, b, batch, results);
+
     while (1)
     {
-        ssize_t r = recvfrom(sockfd, resp, LAT_PAYLOAD_SIZE, 0, (struct sockaddr *)&client_addr, &client_addr_len);
-        printf("Received packet, resp[0]=0x%02X\n", resp[0]);
-        if (r < 0)
+        for (int i = 0; i < batch; i++)
+            b->in[i].msg_hdr.msg_namelen = sizeof b->addr[i];
+
+        // Bloquea hasta el primero y toma los que ya estén en cola
+        int n = recvmmsg(sockfd, b->in, batch, MSG_WAITFORONE, NULL);
+        if (n < 0)
         {
-            perror("recvfrom");
+            if (errno != EINTR)
+                perror("recvmmsg");
             continue; // Ignora errores de recepción
         }
-        if (r != LAT_PAYLOAD_SIZE)
+        echo_batch_serve(sockfd, b, n, results);
+    }
+    free(b);
+    close(sockfd);
+    return NULL;
+}
+
+// Estado compartido entre quien envía las sondas y el hilo que las recibe
+typedef struct probe_rx
+{
+    int sockfd;
+    uint16_t run_id;
+    uint32_t planned;  // sondas que se enviarán como máximo
+    uint8_t *seen;     // bitmap por seq
+    uint32_t max_seq;  // mayor seq recibida + 1
+    int stop;          // lo pone el emisor tras la espera final
+    lat_probe_result_t *res;
+    // Sólo con sellos del kernel (CLOCK_REALTIME), 0 = no llegó
+    uint64_t *tx_kernel; // por id de envío (SOF_TIMESTAMPING_OPT_ID)
+    uint32_t *id_seq;    // seq de cada id de envío, lo escribe el emisor
+    uint32_t sends;      // ids usados
+    uint64_t *rx_kernel; // por seq
+    uint64_t *rtt_user;  // por seq, en ns
+    owd_sample_t *owd;   // por seq; t2 = 0 si no llegó o el servidor no la selló
+} probe_rx_t;
+
+static uint64_t ts_ns(const struct timespec *t)
+{
+    return (uint64_t)t->tv_sec * 1000000000ULL + (uint64_t)t->tv_nsec;
+}
+
+// Distinto en cada corrida, aun si empiezan juntas o en el mismo segundo, sin depender de srand()
+static uint16_t probe_run_id(void)
+{
+    static uint32_t runs;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    uint64_t x = ts_ns(&t) ^ ((uint64_t)getpid() << 32) ^
+                 (uint64_t)__atomic_add_fetch(&runs, 1, __ATOMIC_RELAXED) * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint16_t)x;
+}
+
+static int64_t realtime_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (int64_t)ts_ns(&t);
+}
+
+static int64_t get_be64(const uint8_t *p)
+{
+    uint64_t be;
+    memcpy(&be, p, sizeof be);
+    return (int64_t)be64toh(be);
+}
+
+// Sello de software de un SCM_TIMESTAMPING en los mensajes de control, o 0
+static uint64_t cmsg_kernel_ts(struct msghdr *msg)
+{
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct scm_timestamping tss;
+            memcpy(&tss, CMSG_DATA(cm), sizeof tss);
+            return ts_ns(&tss.ts[0]);
+        }
+    }
+    return 0;
+}
+
+// Vacía la cola de errores: un sello TX por sonda, con su id de envío
+static void drain_tx_stamps(probe_rx_t *rx)
+{
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof control};
+    while (recvmsg(rx->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0)
+    {
+        uint64_t stamp = cmsg_kernel_ts(&msg);
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
         {
-            fprintf(stderr, "Invalid packet received\n");
-            continue; // Ignora paquetes inválidos
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR)
+                continue;
+            struct sock_extended_err ee;
+            memcpy(&ee, CMSG_DATA(cm), sizeof ee);
+            if (ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING && ee.ee_info == SCM_TSTAMP_SND &&
+                ee.ee_data < rx->planned)
+                rx->tx_kernel[ee.ee_data] = stamp;
         }
+        msg.msg_controllen = sizeof control;
+    }
+}
 
-        // Enviar resultados de Upload si el primer byte no es 0xff
-        if (resp[0] != 0xff)
+static void *probe_receiver(void *arg)
+{
+    probe_rx_t *rx = arg;
+    lat_probe_result_t *res = rx->res;
+    uint8_t buf[LAT_MAX_REQUEST];
+    char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    struct iovec iov = {.iov_base = buf, .iov_len = sizeof buf};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    while (!__atomic_load_n(&rx->stop, __ATOMIC_ACQUIRE) && res->received < rx->planned)
+    {
+        if (res->kernel_ts)
         {
-            if (send_results_udp(sockfd, resp, results_lock, client_addr, client_addr_len) < 0)
-            {
-                fprintf(stderr, "Error sending results\n");
-            }
+            drain_tx_stamps(rx);
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof control;
         }
+        ssize_t r = recvmsg(rx->sockfd, &msg, 0);
+        struct timespec now = now_ts();
+        int64_t now_real = realtime_ns();
+        if (r < 0)
+            continue; // timeout: vuelve a mirar stop
+        uint16_t run_id;
+        uint32_t seq;
+        uint64_t sent_ns;
+        memcpy(&run_id, buf + 2, sizeof run_id);
+        memcpy(&seq, buf + 4, sizeof seq);
+        memcpy(&sent_ns, buf + 8, sizeof sent_ns);
+        if (r != LAT_PROBE_SIZE || buf[0] != 0xff || buf[1] != LAT_PROBE_VERSION ||
+            run_id != rx->run_id || seq >= rx->planned)
+            continue; // de otra corrida o inválida
 
+        if (rx->seen[seq / 8] & (1u << (seq % 8)))
+        {
+            res->duplicates++;
+            continue;
+        }
+        rx->seen[seq / 8] |= (uint8_t)(1u << (seq % 8));
+        if (seq + 1 < rx->max_seq)
+            res->reordered++;
         else
+            rx->max_seq = seq + 1;
+
+        res->received++;
+        hist_record(&res->hist, ts_ns(&now) - sent_ns);
+        owd_sample_t *o = &rx->owd[seq];
+        memcpy(&o->t1, buf + 16, sizeof o->t1);
+        o->t2 = get_be64(buf + LAT_PROBE_SERVER_RX);
+        o->t3 = get_be64(buf + LAT_PROBE_SERVER_TX);
+        o->t4 = now_real;
+        if (res->kernel_ts)
         {
-            // Responde con el mismo paquete recibido
-            if (sendto(sockfd, resp, LAT_PAYLOAD_SIZE, 0, (struct sockaddr *)&client_addr, addr_len) < 0)
-            {
-                perror("sendto");
-                continue; // Ignora errores de envío
-            }
-            printf("Echoed packet to %s:%d\n",
-                   inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            rx->rx_kernel[seq] = cmsg_kernel_ts(&msg);
+            rx->rtt_user[seq] = ts_ns(&now) - sent_ns;
         }
     }
-    close(sockfd);
+    if (res->kernel_ts)
+        drain_tx_stamps(rx);
     return NULL;
 }
 
-int client_measure_latency(const char *srv_ip, int tries, int timeout_sec,
-                           double *rtts)
+// Activa los sellos de software TX y RX; los TX llevan el número de envío
+static int enable_kernel_ts(probe_rx_t *rx)
+{
+    const unsigned ts_flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                              SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(rx->sockfd, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof ts_flags) < 0)
+    {
+        perror("setsockopt SO_TIMESTAMPING (kernel RTT disabled)");
+        return -1;
+    }
+    rx->tx_kernel = calloc(rx->planned, sizeof *rx->tx_kernel);
+    rx->id_seq = calloc(rx->planned, sizeof *rx->id_seq);
+    rx->rx_kernel = calloc(rx->planned, sizeof *rx->rx_kernel);
+    rx->rtt_user = calloc(rx->planned, sizeof *rx->rtt_user);
+    if (!rx->tx_kernel || !rx->id_seq || !rx->rx_kernel || !rx->rtt_user)
+    {
+        perror("calloc (kernel timestamps)");
+        return -1;
+    }
+    return 0;
+}
+
+// Junta los sellos de cada sonda respondida, con el receptor ya terminado
+static void collect_kernel_rtts(probe_rx_t *rx)
+{
+    lat_probe_result_t *res = rx->res;
+    for (uint32_t id = 0; id < rx->sends; id++)
+    {
+        uint32_t seq = rx->id_seq[id];
+        uint64_t tx = rx->tx_kernel[id], rxk = rx->rx_kernel[seq];
+        if (!tx || !rxk || rxk < tx)
+            continue;
+        uint64_t kernel = rxk - tx;
+        hist_record(&res->kernel_hist, kernel);
+        hist_record(&res->gap_hist, rx->rtt_user[seq] > kernel ? rx->rtt_user[seq] - kernel : 0);
+    }
+    res->kernel_ts = res->kernel_hist.count > 0;
+}
+
+static void free_probe_rx(probe_rx_t *rx)
+{
+    free(rx->seen);
+    free(rx->tx_kernel);
+    free(rx->id_seq);
+    free(rx->rx_kernel);
+    free(rx->rtt_user);
+    free(rx->owd);
+}
+
+int client_probe_latency(const char *srv_ip, int rate_hz, double duration_s, int flags, const int *stop,
+                         lat_probe_result_t *res)
 {
-    struct sockaddr_in srv_addr, from_addr;
-    socklen_t addr_len = sizeof(srv_addr), from_len = sizeof(from_addr);
+    memset(res, 0, sizeof *res);
+    hist_init(&res->hist);
+    hist_init(&res->kernel_hist);
+    hist_init(&res->gap_hist);
+    if (rate_hz < 1 || rate_hz > LAT_PROBE_MAX_HZ || duration_s <= 0)
+        return LAT_SOCK_ERR;
+
+    struct sockaddr_in srv_addr;
     int sockfd = udp_socket_init(srv_ip, UDP_SERVER_PORT, &srv_addr, 0);
     if (sockfd < 0)
     {
         fprintf(stderr, "Error initializing UDP socket\n");
         return LAT_SOCK_ERR;
     }
-
-    uint8_t payload[LAT_PAYLOAD_SIZE], resp[LAT_PAYLOAD_SIZE];
-    struct timeval tv = {.tv_sec = timeout_sec, .tv_usec = 0};
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+    // connect(): recv() sólo ve respuestas del servidor
+    struct timeval tv = {.tv_sec = 0, .tv_usec = LAT_PROBE_POLL_MS * 1000};
+    if (connect(sockfd, (struct sockaddr *)&srv_addr, sizeof srv_addr) < 0 ||
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
     {
-        perror("setsockopt SO_RCVTIMEO");
+        perror("latency probe socket");
+        close(sockfd);
         return LAT_SOCK_ERR;
     }
 
-    for (int k = 0; k < tries; ++k)
-        rtts[k] = -1.0; // Inicializa RTTs a -1.0
-
-    for (int i = 0; i < tries; i++)
+    probe_rx_t rx = {
+        .sockfd = sockfd,
+        .run_id = probe_run_id(),
+        .planned = (uint32_t)(rate_hz * duration_s) + 1,
+        .res = res};
+    rx.seen = calloc((rx.planned + 7) / 8, 1);
+    rx.owd = calloc(rx.planned, sizeof *rx.owd);
+    res->kernel_ts = (flags & LAT_PROBE_KERNEL_TS) && enable_kernel_ts(&rx) == 0;
+    pthread_t rx_thread;
+    if (!rx.seen || !rx.owd || pthread_create(&rx_thread, NULL, probe_receiver, &rx) != 0)
     {
-        // Primer byte fijo a 0xff según spec
-        payload[0] = 0xff;
-        // Bytes 1–3 aleatorios
-        for (int j = 1; j < LAT_PAYLOAD_SIZE; ++j)
-            payload[j] = (uint8_t)rand();
-
-        struct timespec start = now_ts();
-        if (sendto(sockfd, payload, LAT_PAYLOAD_SIZE, 0,
-                   (struct sockaddr *)&srv_addr, addr_len) < 0)
-        {
-            perror("sendto latency");
-            return LAT_SEND_ERR;
-        }
-
-        ssize_t r = recvfrom(sockfd, resp, LAT_PAYLOAD_SIZE, 0,
-                             (struct sockaddr *)&from_addr, &from_len);
+        perror("latency probe setup");
+        free_probe_rx(&rx);
+        close(sockfd);
+        return LAT_SOCK_ERR;
+    }
 
-        if (r < 0)
+    // Lazo abierto: cada sonda sale en su horario, llegue o no la anterior.
+    // Si el envío se atrasa no se recupera en ráfaga: se sigue desde ahora.
+    uint8_t probe[LAT_PROBE_SIZE] = {0xff, LAT_PROBE_VERSION};
+    memcpy(probe + 2, &rx.run_id, sizeof rx.run_id);
+    uint64_t period_ns = 1000000000ULL / rate_hz;
+    struct timespec start = now_ts(), now = start;
+    uint64_t next_ns = ts_ns(&start), end_ns = next_ns + (uint64_t)(duration_s * 1e9);
+    int ret = LAT_OK;
+    for (uint32_t seq = 0; seq < rx.planned && next_ns < end_ns && !(stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE));
+         seq++)
+    {
+        struct timespec next = {.tv_sec = next_ns / 1000000000ULL, .tv_nsec = next_ns % 1000000000ULL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+            ;
+        now = now_ts();
+        uint64_t sent_ns = ts_ns(&now);
+        memcpy(probe + 4, &seq, sizeof seq);
+        memcpy(probe + 8, &sent_ns, sizeof sent_ns);
+        int64_t sent_real = realtime_ns();
+        memcpy(probe + 16, &sent_real, sizeof sent_real);
+        if (send(sockfd, probe, sizeof probe, 0) < 0)
         {
-            if (errno == EWOULDBLOCK || errno == EAGAIN)
+            if (errno != ECONNREFUSED)
             {
-                fprintf(stderr, "Timeout de %lds esperando respuesta RTT #%d. Abortando.\n",
-                        (long)tv.tv_sec, i + 1);
-                return LAT_TIMEOUT_ERR;
+                perror("send latency probe");
+                ret = LAT_SEND_ERR;
+                break;
             }
-            perror("recvfrom latency");
-            return LAT_RECV_ERR;
         }
-        struct timespec end = now_ts();
+        else if (res->kernel_ts)
+            rx.id_seq[rx.sends++] = seq; // el kernel numera sólo los envíos aceptados
+        res->sent++;
+        next_ns += period_ns;
+        if (next_ns < sent_ns)
+            next_ns = sent_ns + period_ns;
+    }
 
-        if (r != LAT_PAYLOAD_SIZE ||
-            memcmp(payload, resp, LAT_PAYLOAD_SIZE) != 0)
-        {
-            fprintf(stderr, "Paquete inválido: recibido %zd bytes, contenido no coincide\n", r);
-            return LAT_RECV_ERR;
-        }
-        rtts[i] = diff_ts(&start, &end);
+    // Espera las respuestas en vuelo antes de contar las perdidas
+    usleep(LAT_PROBE_GRACE_MS * 1000);
+    __atomic_store_n(&rx.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(rx_thread, NULL);
+    if (res->kernel_ts)
+        collect_kernel_rtts(&rx);
+    owd_estimate(rx.owd, (int)rx.planned, &res->owd);
+    free_probe_rx(&rx);
+    close(sockfd);
 
-        sleep(1); // Espera 1 segundo entre intentos
-    }
+    res->min = res->hist.min_ns / 1e9;
+    res->max = res->hist.max_ns / 1e9;
+    res->avg = hist_mean(&res->hist) / 1e9;
+    return ret;
+}
 
-    return LAT_OK;
-}
\ No newline at end of file
+double lat_probe_loss(const lat_probe_result_t *res)
+{
+    return res->sent ? 1.0 - (double)res->received / res->sent : 0.0;
+}
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include "common.h"
+#include "results_table.h"
+#include "histogram.h" // For lat_hist_t
+#include "owd.h"       // For owd_result_t
 
 #define LAT_PAYLOAD_SIZE 4    // tamaño fijo del payload de latencia
 #define LAT_OK 0              // sin error
@@ -11,10 +14,31 @@
 #define LAT_SOCK_ERR -3       // error de socket
 #define LAT_TIMEOUT_ERR -4    // timeout al recibir
 #define UDP_SERVER_PORT 20251 // puerto del servidor UDP de latencia
+#define LAT_MAX_REQUEST 64    // mayor datagrama aceptado por el servicio UDP
+#define LAT_BATCH 64          // datagramas por recvmmsg()/sendmmsg() del eco
+#define LAT_BUSY_POLL_US 50   // SO_BUSY_POLL del eco en modo busy-poll
+#define LAT_REPORT_S 10       // cada cuánto informa el eco busy-poll su turnaround, con o sin carga
+
+// Sondas de lazo abierto: 0xff, versión, run id (2), seq (4), envío en ns
+// (8, monotónico), envío en ns (8, CLOCK_REALTIME) y los sellos que agrega
+// el servidor al recibirla y al devolverla (8 + 8, CLOCK_REALTIME, big endian)
+#define LAT_PROBE_SIZE 40
+#define LAT_PROBE_VERSION 2
+#define LAT_PROBE_SERVER_RX 24 // offset del sello de recepción del servidor
+#define LAT_PROBE_SERVER_TX 32 // offset del sello de envío del servidor
+#define LAT_PROBE_DEFAULT_HZ 100 // cliente -p
+#define LAT_PROBE_MAX_HZ 10000
+#define LAT_PROBE_GRACE_MS 500 // espera de respuestas tras la última sonda
+#define LAT_PROBE_POLL_MS 50   // el receptor revisa si debe terminar
+#define LAT_PROBE_KERNEL_TS 1  // flag de client_probe_latency(): sellos de software del kernel
 
 typedef struct echo_server_args
 {
-    results_lock_t *results_lock; // Puntero a la estructura de resultados
+    results_table_t *results; // Tabla de resultados de subida
+    int reuseport;            // Comparte el puerto con otros hilos de eco (SO_REUSEPORT)
+    int port;                 // 0: UDP_SERVER_PORT
+    int batch;                // Datagramas por llamada, 1..LAT_BATCH (0: LAT_BATCH)
+    int busy_poll;            // Gira sin dormir (hilo fijado a una CPU) y mide el turnaround
 } echo_server_args_t;
 
 // Atiende peticiones de latencia en el servidor
@@ -23,7 +47,28 @@ int server_measure_latency(int tries);
 // Inicia el servicio de latencia en el servidor
 void *latency_echo_server(void *args);
 
-// Mide RTT desde el cliente
-int client_measure_latency(const char *srv_ip, int tries, int timeout_sec, double *rtts);
+typedef struct lat_probe_result
+{
+    uint64_t sent;
+    uint64_t received;   // respuestas distintas, cada una con su muestra en hist
+    uint64_t duplicates;
+    uint64_t reordered;  // llegaron después de una sonda posterior
+    double min, max, avg; // segundos, sólo de las respondidas
+    lat_hist_t hist;      // distribución completa del RTT, en ns
+    int kernel_ts;          // hubo sellos del kernel (LAT_PROBE_KERNEL_TS aceptado)
+    lat_hist_t kernel_hist; // RTT entre el sello TX y el RX del kernel, en ns
+    lat_hist_t gap_hist;    // RTT de usuario - RTT del kernel: planificador y syscalls
+    owd_result_t owd;       // demora de ida y de vuelta por separado, si el servidor selló
+} lat_probe_result_t;
+
+// Envía sondas a rate_hz durante duration_s sin esperar las respuestas, que
+// recibe otro hilo; las perdidas sólo cuentan en la tasa de pérdida.
+// Con LAT_PROBE_KERNEL_TS en flags también mide el RTT con los sellos
+// SO_TIMESTAMPING del kernel, que no incluyen la demora del planificador;
+// si el kernel no los da, res->kernel_ts queda en 0. Si stop no es NULL, ponerlo
+// en 1 corta el envío antes de duration_s. Retorna LAT_OK o LAT_*_ERR.
+int client_probe_latency(const char *srv_ip, int rate_hz, double duration_s, int flags, const int *stop,
+                         lat_probe_result_t *res);
+double lat_probe_loss(const lat_probe_result_t *res);
 
 #endif // LATENCY_H
@@ -0,0 +1,101 @@
+#include "owd.h"
+#include <math.h>
+#include <string.h>
+
+// Offset seen by one probe and how long it spent on the network
+static double sample_offset(const owd_sample_t *s)
+{
+    return ((double)(s->t2 - s->t1) + (double)(s->t3 - s->t4)) / 2;
+}
+
+static int64_t sample_delay(const owd_sample_t *s)
+{
+    return (s->t4 - s->t1) - (s->t3 - s->t2);
+}
+
+static void record_clamped(lat_hist_t *h, double ns)
+{
+    hist_record(h, ns > 0 ? (uint64_t)llround(ns) : 0);
+}
+
+int owd_estimate(const owd_sample_t *s, int n, owd_result_t *out)
+{
+    memset(out, 0, sizeof *out);
+    hist_init(&out->up);
+    hist_init(&out->down);
+
+    int m = 0, first = -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (s[i].t2 == 0)
+            continue;
+        if (first < 0)
+            first = i;
+        m++;
+    }
+    if (m == 0)
+        return 0;
+
+    // Fastest probe of each window: its offset is the least disturbed by queueing
+    int windows = m / OWD_MIN_WINDOW;
+    if (windows > OWD_WINDOWS)
+        windows = OWD_WINDOWS;
+    if (windows < 1)
+        windows = 1;
+    int best[OWD_WINDOWS];
+    for (int w = 0; w < windows; w++)
+        best[w] = -1;
+    for (int i = 0, k = 0; i < n; i++)
+    {
+        if (s[i].t2 == 0)
+            continue;
+        int w = (int)((int64_t)k++ * windows / m);
+        if (best[w] < 0 || sample_delay(&s[i]) < sample_delay(&s[best[w]]))
+            best[w] = i;
+    }
+
+    // offset(t) = a + b * t, t in seconds since the first probe
+    const int64_t t0 = s[first].t1;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int w = 0; w < windows; w++)
+    {
+        double x = (s[best[w]].t1 - t0) / 1e9, y = sample_offset(&s[best[w]]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double den = windows * sxx - sx * sx;
+    double b = windows >= 2 && den > 0 ? (windows * sxy - sx * sy) / den : 0;
+    double a = (sy - b * sx) / windows;
+
+    double jitter_up = 0, jitter_down = 0;
+    const owd_sample_t *prev = NULL;
+    for (int i = 0; i < n; i++)
+    {
+        const owd_sample_t *c = &s[i];
+        if (c->t2 == 0)
+            continue;
+        double off_t1 = a + b * ((c->t1 - t0) / 1e9);
+        double off_t4 = a + b * ((c->t4 - t0) / 1e9);
+        record_clamped(&out->up, (double)(c->t2 - c->t1) - off_t1);
+        record_clamped(&out->down, (double)(c->t4 - c->t3) + off_t4);
+
+        // RFC 3550 6.4.1: J += (|D(i-1,i)| - J) / 16, one per direction
+        if (prev)
+        {
+            double d_up = (double)((c->t2 - prev->t2) - (c->t1 - prev->t1));
+            double d_down = (double)((c->t4 - prev->t4) - (c->t3 - prev->t3));
+            jitter_up += (fabs(d_up) - jitter_up) / 16;
+            jitter_down += (fabs(d_down) - jitter_down) / 16;
+        }
+        prev = c;
+    }
+
+    out->valid = 1;
+    out->offset_ns = a;
+    out->skew_ppm = b / 1e3; // ns per second
+    out->jitter_up_ns = jitter_up;
+    out->jitter_down_ns = jitter_down;
+    return m;
+}
@@ -0,0 +1,56 @@
+#ifndef OWD_H
+#define OWD_H
+
+#include <stdint.h>
+#include "histogram.h" // For lat_hist_t
+
+#define OWD_WINDOWS 16 // offset samples for the skew fit: the fastest probe of each window
+#define OWD_MIN_WINDOW 4 // probes per window, at least
+
+/**
+ * @brief One answered probe, in CLOCK_REALTIME nanoseconds.
+ *
+ * t1 and t4 are read on the client, t2 and t3 on the server, so the two
+ * pairs differ by the offset between the clocks.
+ */
+typedef struct owd_sample
+{
+    int64_t t1; // client sends
+    int64_t t2; // server receives
+    int64_t t3; // server echoes
+    int64_t t4; // client receives
+} owd_sample_t;
+
+/**
+ * @brief One-way delays of a run, split by direction.
+ */
+typedef struct owd_result
+{
+    int valid;             // the server stamped the probes
+    double offset_ns;      // server clock - client clock, at the first probe
+    double skew_ppm;       // how fast that offset drifts
+    double jitter_up_ns;   // RFC 3550 interarrival jitter, client to server
+    double jitter_down_ns; // server to client
+    lat_hist_t up;         // client -> server delay, ns; negative estimates count as 0
+    lat_hist_t down;       // server -> client
+} owd_result_t;
+
+/**
+ * @brief Estimates the clock offset and splits every RTT into its two halves.
+ *
+ * NTP style: each probe gives an offset ((t2 - t1) + (t3 - t4)) / 2 that
+ * is exact when both directions take equally long, and is most trustworthy
+ * for the probes that were queued least. The fastest probe of each of up to
+ * OWD_WINDOWS windows feeds a least-squares line, whose slope is the skew,
+ * so drift over a long run does not leak into the one-way delays. Any
+ * constant path asymmetry cannot be told apart from offset: the delays are
+ * then shifted by half of it, but how each direction grows under load is
+ * still right. Jitter needs no offset at all.
+ *
+ * @param s Samples in sending order; those with t2 == 0 (not stamped) are skipped.
+ * @param n Number of samples.
+ * @return int Samples used; 0 leaves out->valid at 0.
+ */
+int owd_estimate(const owd_sample_t *s, int n, owd_result_t *out);
+
+#endif // OWD_H
@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+
+#include "payload.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PAYLOAD_X86 1
+#include <immintrin.h>
+#endif
+
+static char *pl_data;
+static size_t pl_len, pl_send;
+static const char *pl_backing = "4k";
+static int pl_rng = -1; // generator of a random payload
+
+// 2 MB-aligned anonymous region the kernel may back with transparent huge pages
+static char *map_thp(size_t len)
+{
+    // Over-allocate and trim: THP needs the range aligned to the huge page
+    size_t span = len + PAYLOAD_HUGE_PAGE;
+    char *p = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    char *aligned = (char *)(((uintptr_t)p + PAYLOAD_HUGE_PAGE - 1) & ~(uintptr_t)(PAYLOAD_HUGE_PAGE - 1));
+    if (aligned > p)
+        munmap(p, aligned - p);
+    if (p + span > aligned + len)
+        munmap(aligned + len, p + span - (aligned + len));
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, len, MADV_HUGEPAGE) == 0)
+        pl_backing = "thp";
+#endif
+    return aligned;
+}
+
+// xorshift128+ lanes, seeded through splitmix64 so any seed gives good states
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+#define RNG_LANES 8 // 2 x 4 64-bit lanes: two AVX2 generators in flight
+
+static void seed_lanes(uint64_t seed, uint64_t s0[RNG_LANES], uint64_t s1[RNG_LANES])
+{
+    for (int i = 0; i < RNG_LANES; i++)
+    {
+        s0[i] = splitmix64(&seed);
+        s1[i] = splitmix64(&seed);
+    }
+}
+
+static void fill_scalar(uint8_t *dst, size_t len, uint64_t s0[RNG_LANES], uint64_t s1[RNG_LANES])
+{
+    size_t i = 0;
+    for (int lane = 0; i < len; lane = (lane + 1) % RNG_LANES)
+    {
+        uint64_t a = s0[lane], b = s1[lane];
+        s0[lane] = b;
+        a ^= a << 23;
+        s1[lane] = a ^ b ^ (a >> 17) ^ (b >> 26);
+        uint64_t v = s1[lane] + b;
+        size_t n = len - i < sizeof v ? len - i : sizeof v;
+        memcpy(dst + i, &v, n);
+        i += n;
+    }
+}
+
+#ifdef PAYLOAD_X86
+// Two independent 2-lane generators per iteration: 32 bytes
+__attribute__((target("sse2"))) static void fill_sse2(uint8_t *dst, size_t len, uint64_t s0[RNG_LANES], uint64_t s1[RNG_LANES])
+{
+    __m128i a0 = _mm_loadu_si128((const __m128i *)s0), b0 = _mm_loadu_si128((const __m128i *)s1);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(s0 + 2)), b1 = _mm_loadu_si128((const __m128i *)(s1 + 2));
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m128i x0 = a0, y0 = b0, x1 = a1, y1 = b1;
+        a0 = y0;
+        a1 = y1;
+        x0 = _mm_xor_si128(x0, _mm_slli_epi64(x0, 23));
+        x1 = _mm_xor_si128(x1, _mm_slli_epi64(x1, 23));
+        b0 = _mm_xor_si128(_mm_xor_si128(x0, y0), _mm_xor_si128(_mm_srli_epi64(x0, 17), _mm_srli_epi64(y0, 26)));
+        b1 = _mm_xor_si128(_mm_xor_si128(x1, y1), _mm_xor_si128(_mm_srli_epi64(x1, 17), _mm_srli_epi64(y1, 26)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi64(b0, y0));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_add_epi64(b1, y1));
+    }
+    _mm_storeu_si128((__m128i *)s0, a0);
+    _mm_storeu_si128((__m128i *)s1, b0);
+    _mm_storeu_si128((__m128i *)(s0 + 2), a1);
+    _mm_storeu_si128((__m128i *)(s1 + 2), b1);
+    fill_scalar(dst + i, len - i, s0, s1);
+}
+
+// The same with 4-lane generators: 64 bytes per iteration
+__attribute__((target("avx2"))) static void fill_avx2(uint8_t *dst, size_t len, uint64_t s0[RNG_LANES],
+                                                      uint64_t s1[RNG_LANES])
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)s0), b0 = _mm256_loadu_si256((const __m256i *)s1);
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(s0 + 4)), b1 = _mm256_loadu_si256((const __m256i *)(s1 + 4));
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+        __m256i x0 = a0, y0 = b0, x1 = a1, y1 = b1;
+        a0 = y0;
+        a1 = y1;
+        x0 = _mm256_xor_si256(x0, _mm256_slli_epi64(x0, 23));
+        x1 = _mm256_xor_si256(x1, _mm256_slli_epi64(x1, 23));
+        b0 = _mm256_xor_si256(_mm256_xor_si256(x0, y0),
+                              _mm256_xor_si256(_mm256_srli_epi64(x0, 17), _mm256_srli_epi64(y0, 26)));
+        b1 = _mm256_xor_si256(_mm256_xor_si256(x1, y1),
+                              _mm256_xor_si256(_mm256_srli_epi64(x1, 17), _mm256_srli_epi64(y1, 26)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi64(b0, y0));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_add_epi64(b1, y1));
+    }
+    _mm256_storeu_si256((__m256i *)s0, a0);
+    _mm256_storeu_si256((__m256i *)s1, b0);
+    _mm256_storeu_si256((__m256i *)(s0 + 4), a1);
+    _mm256_storeu_si256((__m256i *)(s1 + 4), b1);
+    fill_scalar(dst + i, len - i, s0, s1);
+}
+#endif
+
+int payload_rng_best(void)
+{
+#ifdef PAYLOAD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PAYLOAD_RNG_AVX2;
+#ifdef __x86_64__
+    return PAYLOAD_RNG_SSE2; // always there on x86-64
+#else
+    if (__builtin_cpu_supports("sse2"))
+        return PAYLOAD_RNG_SSE2;
+#endif
+#endif
+    return PAYLOAD_RNG_SCALAR;
+}
+
+const char *payload_rng_name(int rng)
+{
+    static const char *const names[] = {"scalar", "sse2", "avx2"};
+    return (rng >= PAYLOAD_RNG_SCALAR && rng <= PAYLOAD_RNG_AVX2) ? names[rng] : "?";
+}
+
+void payload_fill_random(void *dst, size_t len, uint64_t seed, int rng)
+{
+    uint64_t s0[RNG_LANES], s1[RNG_LANES];
+    seed_lanes(seed, s0, s1);
+#ifdef PAYLOAD_X86
+    if (rng == PAYLOAD_RNG_AVX2)
+    {
+        fill_avx2(dst, len, s0, s1);
+        return;
+    }
+    if (rng == PAYLOAD_RNG_SSE2)
+    {
+        fill_sse2(dst, len, s0, s1);
+        return;
+    }
+#else
+    (void)rng;
+#endif
+    fill_scalar(dst, len, s0, s1);
+}
+
+int payload_mode_parse(const char *name)
+{
+    if (strcmp(name, "const") == 0)
+        return 0;
+    if (strcmp(name, "random") == 0)
+        return PAYLOAD_RANDOM;
+    return -1;
+}
+
+int payload_init(size_t send_size, int flags)
+{
+    if (pl_data)
+        return 0;
+    if (send_size == 0 || send_size > PAYLOAD_MAX_SEND)
+    {
+        fprintf(stderr, "payload: send size must be 1 to %d bytes\n", PAYLOAD_MAX_SEND);
+        return -1;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t align = (flags & PAYLOAD_HUGEPAGES) ? PAYLOAD_HUGE_PAGE : (size_t)(page > 0 ? page : 4096);
+    size_t len = (send_size + align - 1) / align * align;
+    if ((flags & PAYLOAD_RANDOM) && len < PAYLOAD_RANDOM_LEN)
+        len = PAYLOAD_RANDOM_LEN; // a multiple of both page sizes
+    char *p = NULL;
+
+    if (flags & PAYLOAD_HUGEPAGES)
+    {
+        // Reserved huge pages (vm.nr_hugepages) first, transparent ones otherwise
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            pl_backing = "hugetlb";
+        else
+            p = map_thp(len);
+    }
+    else
+    {
+        // Page-aligned so MSG_ZEROCOPY pins whole pages of nothing but payload
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            p = NULL;
+    }
+    if (!p)
+    {
+        perror("mmap (payload)");
+        return -1;
+    }
+
+    if (flags & PAYLOAD_RANDOM)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        pl_rng = payload_rng_best();
+        payload_fill_random(p, len, (uint64_t)t.tv_nsec ^ ((uint64_t)getpid() << 32), pl_rng);
+    }
+    else
+        memset(p, (flags & PAYLOAD_UPLOAD) ? 0xAA : 'A', len);
+    if (!(flags & PAYLOAD_PINNABLE))
+        mprotect(p, len, PROT_READ);
+
+    pl_len = len;
+    pl_send = send_size;
+    pl_data = p;
+    return 0;
+}
+
+const char *payload_data(void)
+{
+    return pl_data;
+}
+
+size_t payload_len(void)
+{
+    return pl_len;
+}
+
+size_t payload_send_size(void)
+{
+    return pl_send;
+}
+
+const char *payload_backing(void)
+{
+    return pl_backing;
+}
+
+int payload_rng(void)
+{
+    return pl_rng;
+}
+
+size_t payload_advance(size_t off, size_t sent)
+{
+    off += sent;
+    return off + pl_send > pl_len ? 0 : off;
+}
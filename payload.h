@@ -0,0 +1,74 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAYLOAD_MAX_SEND (4 * 1024 * 1024) // largest send size (-S)
+#define PAYLOAD_HUGE_PAGE (2 * 1024 * 1024)
+// Random payloads span more than the history of LZ-style compressors and
+// dedup caches (zstd's default window is 8 MB): the wire never repeats within it
+#define PAYLOAD_RANDOM_LEN (16 * 1024 * 1024)
+
+// Flags for payload_init()
+#define PAYLOAD_HUGEPAGES 1 // 2 MB pages: hugetlbfs if reserved, else transparent ones
+#define PAYLOAD_PINNABLE 2  // keep it writable: io_uring only registers writable memory
+#define PAYLOAD_UPLOAD 4    // constant fill 0xAA, the byte uploads have always sent, instead of 'A'
+#define PAYLOAD_RANDOM 8    // incompressible pseudo-random bytes instead of 'A'
+
+// Random generators (payload_fill_random)
+#define PAYLOAD_RNG_SCALAR 0
+#define PAYLOAD_RNG_SSE2 1
+#define PAYLOAD_RNG_AVX2 2
+
+/**
+ * @brief Process-wide payload: one page-aligned region every sender shares.
+ *
+ * All streams send the same bytes from the same pages, so they share their
+ * cache lines and TLB entries, and the region can be pinned for
+ * MSG_ZEROCOPY or registered with io_uring once. It is never written after
+ * payload_init(); unless PAYLOAD_PINNABLE it is also mapped read-only.
+ * With PAYLOAD_RANDOM it is filled once, at several GB/s, and spans
+ * PAYLOAD_RANDOM_LEN; senders walk it with payload_advance().
+ *
+ * @param send_size Bytes handed to the kernel per send, up to PAYLOAD_MAX_SEND.
+ * @param flags PAYLOAD_HUGEPAGES, PAYLOAD_PINNABLE, PAYLOAD_UPLOAD, PAYLOAD_RANDOM.
+ * @return int 0, or -1 on error. Only the first call sets the payload up.
+ */
+int payload_init(size_t send_size, int flags);
+
+// The region (NULL before payload_init), its mapped length and the send size
+const char *payload_data(void);
+size_t payload_len(void);
+size_t payload_send_size(void);
+
+// How the region is backed, for logs: "4k", "thp" or "hugetlb"
+const char *payload_backing(void);
+
+// Generator of a PAYLOAD_RANDOM payload (PAYLOAD_RNG_*), -1 for a constant one
+int payload_rng(void);
+
+/**
+ * @brief Offset of a sender's next send in the region.
+ *
+ * @param off Offset of the last send.
+ * @param sent Bytes it sent.
+ * @return size_t off + sent, or 0 when a whole send no longer fits after it.
+ */
+size_t payload_advance(size_t off, size_t sent);
+
+/**
+ * @brief Fills dst with xorshift128+ output, several lanes at a time.
+ *
+ * Not cryptographic: it only has to defeat compression.
+ *
+ * @param rng PAYLOAD_RNG_*; the best one the CPU supports is payload_rng_best().
+ */
+void payload_fill_random(void *dst, size_t len, uint64_t seed, int rng);
+int payload_rng_best(void);
+const char *payload_rng_name(int rng);
+
+// Parses -P: "const" (0) or "random" (PAYLOAD_RANDOM); -1 if unknown
+int payload_mode_parse(const char *name);
+
+#endif // PAYLOAD_H
@@ -0,0 +1,69 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ramp.h"
+#include "common.h" // For now_ts, diff_ts
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+    while (nanosleep(&ts, &ts) != 0)
+        ;
+}
+
+int ramp_run(int max_streams, double threshold, ramp_start_fn start, adapt_sample_fn sample, void *ctx,
+             ramp_result_t *out)
+{
+    memset(out, 0, sizeof *out);
+    int started = 0;
+
+    for (int target = 1; out->n_points < RAMP_MAX_STEPS; target *= 2)
+    {
+        if (target > max_streams)
+            target = max_streams;
+        for (; started < target; started++)
+        {
+            if (start(ctx, started) < 0)
+                break;
+        }
+        if (started == 0)
+            return -1; // not even one stream: nothing to measure
+        if (started < target)
+            break; // this step went unmeasured: keep the last choice
+
+        sleep_ms(RAMP_SETTLE_MS);
+        uint64_t b0, b1;
+        sample(ctx, &b0);
+        struct timespec t0 = now_ts();
+        sleep_ms(RAMP_MEASURE_MS);
+        int running = sample(ctx, &b1);
+        struct timespec t1 = now_ts();
+
+        ramp_point_t *p = &out->points[out->n_points++];
+        p->streams = started;
+        p->bps = (b1 - b0) * 8.0 / diff_ts(&t0, &t1);
+        printf("client: ramp %d stream(s): %.2f Mb/s\n", p->streams, p->bps / 1e6);
+
+        // Streams that ended (refused, server deadline) make the step meaningless
+        if (running < started)
+            break;
+        if (out->n_points > 1 && p->bps < p[-1].bps * (1 + threshold))
+            break; // saturated: the previous step is enough
+        out->chosen = started;
+        if (started == max_streams)
+            break;
+    }
+    if (out->chosen == 0)
+        out->chosen = 1;
+    return out->chosen;
+}
+
+void ramp_print(const ramp_result_t *r, const char *what)
+{
+    printf("%s: saturation curve (streams: Mb/s)\n", what);
+    for (int i = 0; i < r->n_points; i++)
+        printf("  %4d: %.2f%s\n", r->points[i].streams, r->points[i].bps / 1e6,
+               r->points[i].streams == r->chosen ? " <- chosen" : "");
+}
@@ -0,0 +1,51 @@
+#ifndef RAMP_H
+#define RAMP_H
+
+#include "adaptive.h" // For adapt_sample_fn
+
+#define RAMP_SETTLE_MS 300     // after adding streams, let them leave slow start
+#define RAMP_MEASURE_MS 700    // then measure the aggregate rate
+#define RAMP_MAX_STEPS 12      // 1, 2, 4 ... 1024 streams, and the cap if not a power of two
+#define RAMP_DEFAULT_MAX 64    // stream cap when -n is not given
+
+// One step of the saturation curve
+typedef struct ramp_point
+{
+    int streams;
+    double bps; // aggregate, all streams
+} ramp_point_t;
+
+typedef struct ramp_result
+{
+    ramp_point_t points[RAMP_MAX_STEPS];
+    int n_points;
+    int chosen; // fewest streams that reach the plateau
+} ramp_result_t;
+
+/**
+ * @brief Starts stream i (0-based) of the ramp.
+ *
+ * @return int 0, or -1 if it could not be started (the ramp then ends).
+ */
+typedef int (*ramp_start_fn)(void *ctx, int stream);
+
+/**
+ * @brief Finds how many parallel streams saturate the path.
+ *
+ * Starts with one stream and doubles them, up to max_streams, measuring the
+ * aggregate rate RAMP_SETTLE_MS after every step for RAMP_MEASURE_MS. The
+ * ramp ends as soon as a step improves the rate by less than threshold
+ * (e.g. 0.1 for 10%), or a stream ended by itself; the streams before that
+ * step are the chosen count. Streams keep running: the caller stops them.
+ *
+ * @param sample Reads the bytes moved so far by the running streams.
+ * @return int The chosen number of streams (at least 1), also in out->chosen,
+ *         or -1 if not even the first stream could be started.
+ */
+int ramp_run(int max_streams, double threshold, ramp_start_fn start, adapt_sample_fn sample, void *ctx,
+             ramp_result_t *out);
+
+// Prints the saturation curve, one line per step
+void ramp_print(const ramp_result_t *r, const char *what);
+
+#endif // RAMP_H
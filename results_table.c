@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+
+#include "results_table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// test ids are random, but mix them anyway so a client cannot pick a shard
+static uint32_t rt_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static rt_shard_t *shard_of(results_table_t *t, uint32_t h)
+{
+    return &t->shards[h % RT_SHARDS];
+}
+
+// Bucket index bits come from the top of the hash, the shard from the bottom
+static unsigned home_of(unsigned mask, uint32_t h)
+{
+    return (h >> 8) & mask;
+}
+
+static void mem_add(results_table_t *t, long delta)
+{
+    __atomic_add_fetch(&t->stats.bytes, (size_t)delta, __ATOMIC_RELAXED);
+}
+
+// Rehashes s into n_buckets (power of two); s->mutex held
+static int shard_resize(results_table_t *t, rt_shard_t *s, unsigned n_buckets)
+{
+    rt_entry_t **buckets = calloc(n_buckets, sizeof *buckets);
+    if (!buckets)
+        return -1;
+
+    unsigned mask = n_buckets - 1;
+    for (unsigned i = 0; i <= s->mask; i++)
+    {
+        rt_entry_t *e = s->buckets[i];
+        if (!e)
+            continue;
+        unsigned j = home_of(mask, rt_hash(e->id));
+        while (buckets[j])
+            j = (j + 1) & mask;
+        buckets[j] = e;
+    }
+
+    mem_add(t, ((long)n_buckets - (long)(s->mask + 1)) * (long)sizeof *buckets);
+    __atomic_add_fetch(&t->stats.buckets, (size_t)n_buckets - (s->mask + 1), __ATOMIC_RELAXED);
+    free(s->buckets);
+    s->buckets = buckets;
+    s->mask = mask;
+    return 0;
+}
+
+// Index of test_id in s, or of the empty bucket where it would go
+static unsigned probe(const rt_shard_t *s, uint32_t test_id, uint32_t h)
+{
+    unsigned i = home_of(s->mask, h);
+    while (s->buckets[i] && s->buckets[i]->id != test_id)
+        i = (i + 1) & s->mask;
+    return i;
+}
+
+#define RT_BLOCK_BYTES (RT_BLOCK_CONNS * sizeof(conn_counter_t))
+
+static void entry_unref(results_table_t *t, rt_entry_t *e)
+{
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        long bytes = sizeof *e;
+        for (int b = 0; b < RT_MAX_BLOCKS; b++)
+        {
+            if (!e->blocks[b])
+                continue;
+            for (int c = 0; c < RT_BLOCK_CONNS; c++)
+            {
+                if (e->blocks[b][c].series)
+                    bytes += sizeof(ts_ring_t);
+                free(e->blocks[b][c].series);
+            }
+            bytes += RT_BLOCK_BYTES;
+            free(e->blocks[b]);
+        }
+        free(e);
+        mem_add(t, -bytes);
+    }
+}
+
+// Backward-shift deletion: keeps linear probing correct without tombstones.
+// Shrinks the shard when it falls below 1/8 load. s->mutex held.
+static void remove_at(results_table_t *t, rt_shard_t *s, unsigned hole)
+{
+    s->buckets[hole] = NULL;
+    s->count--;
+    for (unsigned j = (hole + 1) & s->mask; s->buckets[j]; j = (j + 1) & s->mask)
+    {
+        unsigned home = home_of(s->mask, rt_hash(s->buckets[j]->id));
+        // Move j into the hole unless its home lies cyclically in (hole, j]
+        if (((j - home) & s->mask) >= ((j - hole) & s->mask))
+        {
+            s->buckets[hole] = s->buckets[j];
+            s->buckets[j] = NULL;
+            hole = j;
+        }
+    }
+    __atomic_sub_fetch(&t->stats.tests, 1, __ATOMIC_RELAXED);
+
+    if (s->mask + 1 > RT_MIN_BUCKETS && 8 * s->count < s->mask + 1)
+        shard_resize(t, s, (s->mask + 1) / 2); // on failure the shard just stays larger
+}
+
+// Wakes the handlers of a hung test: their reads fail, they end and release it.
+// Its shard's mutex held, so no holder can release, and close, its fd meanwhile.
+static int shutdown_holders(rt_entry_t *e)
+{
+    int n = 0;
+    for (int c = 0; c < e->n_conn; c++)
+    {
+        conn_counter_t *block = e->blocks[c / RT_BLOCK_CONNS];
+        if (block && block[c % RT_BLOCK_CONNS].fd >= 0)
+        {
+            shutdown(block[c % RT_BLOCK_CONNS].fd, SHUT_RDWR);
+            n++;
+        }
+    }
+    return n;
+}
+
+static void *reaper_thread(void *arg)
+{
+    results_table_t *t = arg;
+    unsigned period = t->ttl >= 4 ? (unsigned)t->ttl / 4 : 1;
+
+    while (1)
+    {
+        sleep(period);
+        struct timespec now = now_ts();
+        int evicted = 0, hung = 0;
+
+        for (int k = 0; k < RT_SHARDS; k++)
+        {
+            rt_shard_t *s = &t->shards[k];
+            pthread_mutex_lock(&s->mutex);
+            for (unsigned i = 0; i <= s->mask; i++)
+            {
+                // Re-check i after a removal: backward shift may have moved an entry into it.
+                // A shrink restarts the scan; entries it misses go on the next pass.
+                while (i <= s->mask && s->buckets[i])
+                {
+                    rt_entry_t *e = s->buckets[i];
+                    // Reported tests go quietly once repeated requests are unlikely
+                    double age = diff_ts(&e->created, &now);
+                    if (e->taken ? diff_ts(&e->taken_at, &now) < RT_TAKEN_TTL : age < t->ttl)
+                        break;
+                    if (__atomic_load_n(&e->refs, __ATOMIC_ACQUIRE) > 1)
+                    {
+                        if (age < RT_MAX_AGE)
+                            break;
+                        hung += shutdown_holders(e);
+                    }
+                    unsigned old_mask = s->mask;
+                    if (!e->taken)
+                        evicted++;
+                    remove_at(t, s, i);
+                    entry_unref(t, e);
+                    if (s->mask != old_mask)
+                        i = 0;
+                }
+            }
+            pthread_mutex_unlock(&s->mutex);
+        }
+
+        if (hung > 0)
+        {
+            __atomic_add_fetch(&t->stats.hung, hung, __ATOMIC_RELAXED);
+            printf("server: results table shut down %d connection(s) still running after %d s\n", hung, RT_MAX_AGE);
+        }
+        if (evicted > 0)
+        {
+            __atomic_add_fetch(&t->stats.evicted, evicted, __ATOMIC_RELAXED);
+            rt_stats_t st;
+            rt_get_stats(t, &st);
+            printf("server: results table evicted %d stale test(s); %d tests, %zu buckets, %.1f KB\n",
+                   evicted, st.tests, st.buckets, st.bytes / 1024.0);
+        }
+    }
+    return NULL;
+}
+
+int rt_init(results_table_t *t, int capacity, int ttl)
+{
+    memset(t, 0, sizeof *t);
+    t->capacity = capacity;
+    t->ttl = ttl;
+
+    for (int i = 0; i < RT_SHARDS; i++)
+    {
+        rt_shard_t *s = &t->shards[i];
+        pthread_mutex_init(&s->mutex, NULL);
+        s->mask = RT_MIN_BUCKETS - 1;
+        s->buckets = calloc(RT_MIN_BUCKETS, sizeof *s->buckets);
+        if (!s->buckets)
+        {
+            perror("calloc (results table)");
+            return -1;
+        }
+    }
+    t->stats.buckets = RT_SHARDS * RT_MIN_BUCKETS;
+    t->stats.bytes = t->stats.buckets * sizeof(rt_entry_t *);
+
+    if (pthread_create(&t->reaper, NULL, reaper_thread, t) != 0)
+    {
+        perror("pthread_create (results reaper)");
+        return -1;
+    }
+    pthread_detach(t->reaper);
+    return 0;
+}
+
+// Puts a new test in bucket i, where probe() left it; NULL (a rejection) if
+// capacity is reached or memory ran out. s->mutex held.
+static rt_entry_t *entry_create(results_table_t *t, rt_shard_t *s, unsigned i, uint32_t test_id)
+{
+    void *mem = NULL;
+    // s->count < s->mask keeps one bucket empty, so probing ends even if a grow failed
+    if (__atomic_add_fetch(&t->stats.tests, 1, __ATOMIC_RELAXED) > t->capacity || s->count >= s->mask ||
+        posix_memalign(&mem, CACHE_LINE, sizeof(rt_entry_t)) != 0)
+    {
+        __atomic_sub_fetch(&t->stats.tests, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&t->stats.rejected, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    mem_add(t, sizeof(rt_entry_t));
+    rt_entry_t *e = mem;
+    memset(e, 0, sizeof *e);
+    e->id = test_id;
+    e->refs = 1; // the table's
+    e->created = now_ts();
+    s->buckets[i] = e;
+    s->count++;
+
+    // Keep the load at or under 1/2; a failed grow only lengthens probes
+    if (2 * s->count > s->mask + 1)
+        shard_resize(t, s, 2 * (s->mask + 1));
+    return e;
+}
+
+int rt_claim(results_table_t *t, uint32_t test_id, int conn, int fd, rt_entry_t **entry,
+             conn_counter_t **counter)
+{
+    uint32_t h = rt_hash(test_id);
+    rt_shard_t *s = shard_of(t, h);
+    int b = conn / RT_BLOCK_CONNS;
+
+    pthread_mutex_lock(&s->mutex);
+    unsigned i = probe(s, test_id, h);
+    rt_entry_t *e = s->buckets[i];
+    if (e && e->taken)
+    {
+        pthread_mutex_unlock(&s->mutex);
+        return RT_REPORTED;
+    }
+
+    // The stream's block first: a new entry is then never left without it
+    void *block = NULL;
+    if (!e || !e->blocks[b])
+    {
+        if (posix_memalign(&block, CACHE_LINE, RT_BLOCK_BYTES) != 0)
+        {
+            __atomic_add_fetch(&t->stats.rejected, 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&s->mutex);
+            return RT_FULL;
+        }
+        memset(block, 0, RT_BLOCK_BYTES);
+        for (int c = 0; c < RT_BLOCK_CONNS; c++)
+            ((conn_counter_t *)block)[c].fd = -1;
+    }
+
+    if (!e && !(e = entry_create(t, s, i, test_id)))
+    {
+        pthread_mutex_unlock(&s->mutex);
+        free(block);
+        return RT_FULL;
+    }
+    if (block)
+    {
+        e->blocks[b] = block;
+        mem_add(t, RT_BLOCK_BYTES);
+    }
+    if (e->n_conn == 0)
+        e->created = now_ts(); // only downloads so far: the TTL runs from the upload
+    if (conn >= e->n_conn)
+        e->n_conn = conn + 1;
+    conn_counter_t *cc = &e->blocks[b][conn % RT_BLOCK_CONNS];
+    cc->fd = fd;
+    // Without memory for it the stream is still counted, only its series is missing
+    if (!cc->series && (cc->series = calloc(1, sizeof *cc->series)) != NULL)
+        mem_add(t, sizeof *cc->series);
+    __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&s->mutex);
+
+    *entry = e;
+    *counter = cc;
+    return RT_OK;
+}
+
+int rt_add_download(results_table_t *t, uint32_t test_id, const tcp_summary_t *tcp)
+{
+    uint32_t h = rt_hash(test_id);
+    rt_shard_t *s = shard_of(t, h);
+
+    pthread_mutex_lock(&s->mutex);
+    unsigned i = probe(s, test_id, h);
+    rt_entry_t *e = s->buckets[i];
+    int rc = RT_OK;
+    if (e && e->taken)
+        rc = RT_REPORTED;
+    else if (!e && !(e = entry_create(t, s, i, test_id)))
+        rc = RT_FULL;
+    else
+    {
+        e->download.streams++;
+        e->download.retrans += tcp->retrans;
+        e->download.busy_us += tcp->busy_us;
+        e->download.rwnd_limited_us += tcp->rwnd_limited_us;
+        e->download.sndbuf_limited_us += tcp->sndbuf_limited_us;
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return rc;
+}
+
+void rt_release(results_table_t *t, rt_entry_t *entry, conn_counter_t *counter)
+{
+    // Under the mutex the reaper uses: once this returns it no longer touches the fd
+    rt_shard_t *s = shard_of(t, rt_hash(entry->id));
+    pthread_mutex_lock(&s->mutex);
+    counter->fd = -1;
+    pthread_mutex_unlock(&s->mutex);
+    entry_unref(t, entry);
+}
+
+int rt_take(results_table_t *t, uint32_t test_id, struct BW_result *out)
+{
+    uint32_t h = rt_hash(test_id);
+    rt_shard_t *s = shard_of(t, h);
+
+    pthread_mutex_lock(&s->mutex);
+    unsigned i = probe(s, test_id, h);
+    rt_entry_t *e = s->buckets[i];
+    if (e)
+    {
+        if (!e->taken)
+        {
+            e->taken = 1;
+            e->taken_at = now_ts();
+        }
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED); // the reaper may drop it meanwhile
+    }
+    pthread_mutex_unlock(&s->mutex);
+    if (!e)
+        return -1;
+
+    // Taken, no claim can add blocks or streams any more, nor downloads their TCP_INFO
+    int ret = initBwResult(out, e->n_conn);
+    if (ret == 0)
+    {
+        out->id_measurement = e->id;
+        out->download_tcp = e->download;
+        for (int c = 0; c < e->n_conn; c++)
+        {
+            conn_counter_t *block = e->blocks[c / RT_BLOCK_CONNS];
+            if (!block) // streams that never connected stay at zero
+                continue;
+            conn_counter_t *counter = &block[c % RT_BLOCK_CONNS];
+            conn_counter_read(counter, &out->conn_bytes[c], &out->conn_duration[c]);
+            if (counter->series)
+                out->series[c].count = ts_deltas(counter->series, out->series[c].bytes, &out->series[c].first);
+        }
+    }
+
+    entry_unref(t, e);
+    return ret;
+}
+
+void rt_get_stats(results_table_t *t, rt_stats_t *stats)
+{
+    stats->tests = __atomic_load_n(&t->stats.tests, __ATOMIC_RELAXED);
+    stats->buckets = __atomic_load_n(&t->stats.buckets, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&t->stats.bytes, __ATOMIC_RELAXED);
+    stats->evicted = __atomic_load_n(&t->stats.evicted, __ATOMIC_RELAXED);
+    stats->hung = __atomic_load_n(&t->stats.hung, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&t->stats.rejected, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,130 @@
+#ifndef RESULTS_TABLE_H
+#define RESULTS_TABLE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "common.h"        // For conn_counter_t, CACHE_LINE
+#include "handle_result.h" // For MAX_CONN, struct BW_result
+#include "tcpinfo.h"       // For tcp_summary_t
+
+#define RT_SHARDS 16             // independent locks/arrays, picked by hash
+#define RT_DEFAULT_CAPACITY 1024 // upload tests in flight (server -c)
+#define RT_DEFAULT_TTL 60        // seconds a test may wait for its results (server -e)
+#define RT_MAX_AGE 300           // seconds before connections still holding a test are shut down
+#define RT_TAKEN_TTL 10          // seconds a reported test still answers repeated requests
+#define RT_MIN_BUCKETS 8         // per shard; shards grow and shrink from here
+#define RT_BLOCK_CONNS 16        // stream counters allocated together (1 KB; series apart)
+#define RT_MAX_BLOCKS (MAX_CONN / RT_BLOCK_CONNS)
+
+// rt_claim() results
+#define RT_OK 0
+#define RT_FULL -1     // capacity reached: the client must retry later
+#define RT_REPORTED -2 // the test's results were already taken: too late to join
+
+// One upload test. Connections write their counters without locks; the
+// entry is freed when the table and every connection have let go of it.
+// Counters come in blocks allocated as the streams show up, so a 10-stream
+// test costs one block and a 1024-stream one 64. Each claimed stream also
+// gets its own series ring, referenced from its counter.
+typedef struct rt_entry
+{
+    conn_counter_t *blocks[RT_MAX_BLOCKS]; // stream i is blocks[i / RT_BLOCK_CONNS][i % RT_BLOCK_CONNS]
+    int n_conn;              // highest stream claimed + 1
+    uint32_t id;             // test_id as received (network byte order)
+    int refs;                // 1 while in the table + 1 per claimed connection or rt_take()
+    int taken;               // results reported: no more streams, evicted RT_TAKEN_TTL after taken_at
+    struct timespec created; // TTL starts here
+    struct timespec taken_at;
+    struct BW_tcp download;  // sending side of the test's download streams (rt_add_download)
+} rt_entry_t;
+
+typedef struct rt_shard
+{
+    pthread_mutex_t mutex;
+    rt_entry_t **buckets; // open addressing, linear probing, NULL = empty
+    unsigned mask;        // buckets - 1 (power of two): doubled above 1/2 load, halved below 1/8
+    unsigned count;
+} __attribute__((aligned(CACHE_LINE))) rt_shard_t;
+
+typedef struct rt_stats
+{
+    int tests;         // in the table now
+    size_t buckets;    // allocated across shards
+    size_t bytes;      // bucket arrays + entries and counters, including ones only connections still hold
+    uint64_t evicted;  // removed by the reaper after their TTL
+    uint64_t hung;     // connections shut down by the reaper past RT_MAX_AGE
+    uint64_t rejected; // claims refused with RT_FULL
+} rt_stats_t;
+
+// Upload results keyed by test id
+typedef struct results_table
+{
+    rt_shard_t shards[RT_SHARDS];
+    int capacity;     // tests that may be in the table at once
+    int ttl;          // seconds before an unclaimed result is evicted
+    rt_stats_t stats; // updated atomically
+    pthread_t reaper;
+} results_table_t;
+
+/**
+ * @brief Sets up an empty table and starts its reaper thread.
+ *
+ * Shards start at RT_MIN_BUCKETS and grow with the load, so memory follows
+ * the tests in flight rather than capacity. Every ttl/4 seconds the reaper
+ * evicts tests created more than ttl seconds ago whose connections have all
+ * ended (their client never asked for the results, e.g. it crashed or the
+ * request datagram was lost). Tests older than RT_MAX_AGE are evicted even
+ * if connections still hold them: those are hung, and the reaper shuts
+ * their sockets down so their handlers end and let go.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int rt_init(results_table_t *t, int capacity, int ttl);
+
+/**
+ * @brief Finds the test or creates it, and takes a reference for one connection.
+ *
+ * Whichever connection of a test arrives first creates it, so the order in
+ * which they are accepted does not matter. O(1) expected, whatever the
+ * number of tests in flight.
+ *
+ * @param test_id The 4 header bytes as received.
+ * @param conn Stream index, 0..MAX_CONN-1.
+ * @param fd The stream's socket, which the reaper shuts down past RT_MAX_AGE.
+ * @param entry Set to the test; pass it to rt_release() when the connection ends.
+ * @param counter Set to the stream's counter, zeroed when first claimed.
+ * @return int RT_OK, RT_FULL if the test is new and capacity is reached
+ *         or memory for its counters ran out, or RT_REPORTED if its
+ *         results were already taken.
+ */
+int rt_claim(results_table_t *t, uint32_t test_id, int conn, int fd, rt_entry_t **entry,
+             conn_counter_t **counter);
+
+// Drops the reference taken by rt_claim(); call it before closing the socket
+void rt_release(results_table_t *t, rt_entry_t *entry, conn_counter_t *counter);
+
+/**
+ * @brief Adds the TCP_INFO of one of the test's download streams, as sender.
+ *
+ * The download runs before the upload, so this usually creates the test.
+ * Ignored once the results were taken, or if the table is full.
+ *
+ * @return int RT_OK, RT_FULL or RT_REPORTED, as rt_claim().
+ */
+int rt_add_download(results_table_t *t, uint32_t test_id, const tcp_summary_t *tcp);
+
+/**
+ * @brief Returns a snapshot of a test's counters and closes it to new streams.
+ *
+ * The test stays in the table for RT_TAKEN_TTL more seconds, so a repeated
+ * request (a lost reply, the client's fallback to text) is answered too;
+ * the reaper removes it afterwards. out is sized to the test with
+ * initBwResult(); free it with freeBwResult().
+ *
+ * @return int 0 if the test was found, -1 otherwise.
+ */
+int rt_take(results_table_t *t, uint32_t test_id, struct BW_result *out);
+
+void rt_get_stats(results_table_t *t, rt_stats_t *stats);
+
+#endif // RESULTS_TABLE_H
@@ -0,0 +1,74 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdint.h>
+
+#define TS_INTERVAL_MS 100 // sampling interval of every stream
+#define TS_SLOTS 256       // ring slots: 25.6 s; longer streams keep their last TS_SLOTS - 1 intervals
+
+/**
+ * @brief Per-stream throughput series: cumulative bytes at the end of each
+ *        interval since the stream started, in a preallocated ring.
+ *
+ * One writer (the thread serving the stream) records after every receive;
+ * that is a multiply, a compare and a store, so it costs nothing next to
+ * the recv() itself. Readers may run concurrently and see a consistent
+ * prefix.
+ */
+typedef struct ts_ring
+{
+    uint32_t n;               // intervals recorded; published last, with release semantics
+    uint64_t bytes[TS_SLOTS]; // interval i is in bytes[i % TS_SLOTS]
+} ts_ring_t;
+
+/**
+ * @brief Records the cumulative byte count of a stream.
+ *
+ * @param elapsed Seconds since the stream started; never decreases.
+ * @param bytes Bytes received so far.
+ */
+static inline void ts_record(ts_ring_t *s, double elapsed, uint64_t bytes)
+{
+    uint32_t idx = (uint32_t)(elapsed * (1000 / TS_INTERVAL_MS));
+    uint32_t n = s->n; // only this thread writes it
+    if (idx >= n)
+    {
+        // Intervals without data keep the previous total
+        uint64_t last = n ? s->bytes[(n - 1) % TS_SLOTS] : 0;
+        if (idx - n >= TS_SLOTS)
+            n = idx - (TS_SLOTS - 1); // older ones would be overwritten anyway
+        for (; n < idx; n++)
+            __atomic_store_n(&s->bytes[n % TS_SLOTS], last, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->bytes[idx % TS_SLOTS], bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->n, idx + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    __atomic_store_n(&s->bytes[idx % TS_SLOTS], bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Bytes received in each recorded interval.
+ *
+ * @param out At least TS_SLOTS entries; a delta that does not fit 32 bits
+ *        (over 343 Gb/s at 100 ms) is clamped.
+ * @param first Set to the interval index of out[0].
+ * @return int Intervals written to out.
+ */
+static inline int ts_deltas(ts_ring_t *s, uint32_t *out, uint32_t *first)
+{
+    uint32_t n = __atomic_load_n(&s->n, __ATOMIC_ACQUIRE);
+    // Interval 0 is measured from zero; later ones need their predecessor in the ring
+    uint32_t start = n > TS_SLOTS ? n - (TS_SLOTS - 1) : 0;
+    uint64_t prev = start ? __atomic_load_n(&s->bytes[(start - 1) % TS_SLOTS], __ATOMIC_RELAXED) : 0;
+    for (uint32_t i = start; i < n; i++)
+    {
+        uint64_t cur = __atomic_load_n(&s->bytes[i % TS_SLOTS], __ATOMIC_RELAXED);
+        uint64_t d = cur > prev ? cur - prev : 0;
+        out[i - start] = d > UINT32_MAX ? UINT32_MAX : (uint32_t)d;
+        prev = cur;
+    }
+    *first = start;
+    return (int)(n - start);
+}
+
+#endif // SERIES_H
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200112L
+#define _GNU_SOURCE
 
 #include <arpa/inet.h>
 #include <errno.h>
@@ -18,30 +18,77 @@
 #include "latency.h"
 #include "upload.h"
 #include "handle_result.h" /* For struct BW_result and packResultPayload */
-#include "common.h"        /* For results_lock_t, udp_socket_init, now_ts, diff_ts, die */
+#include "common.h"        /* For udp_socket_init, now_ts, diff_ts, die */
+#include "results_table.h" /* For results_table_t */
+#include "event_loop.h"
+#include "uring_loop.h"
+#include "worker_pool.h"
+#include "zerocopy.h"
+#include "payload.h"       /* For payload_init */
+#include "discard.h"
 
 #define IPV4_STRLEN 16
 #define MAX_LATENCY_REQUESTS 1000
 
-static int create_listening_socket(const char *port);
-static void *latency_server_thread();
-static void *download_worker(void *arg);
+// MODE_THREADS worker pool defaults: every connection holds a worker for T_SECONDS
+#define DEFAULT_WORKERS (MAX_CLIENTS * N_CONN * 2)
+#define DEFAULT_QUEUE_LEN 64
+#define DEFAULT_STACK_KB 128
+
+static int create_listening_socket(const char *port, int reuseport);
+static void download_task(void *ctx);
 static void *upload_worker(void *arg);
 
+// Server engines: one thread per connection, epoll or io_uring event loops
+#define MODE_THREADS 0
+#define MODE_EPOLL 1
+#define MODE_URING 2
+
+typedef struct server_opts
+{
+    int mode;    // MODE_THREADS / MODE_EPOLL / MODE_URING
+    int n_loops; // Event loops for MODE_EPOLL/MODE_URING (default: one per core)
+    int sharded; // One SO_REUSEPORT listener and pinned worker per loop (TCP and UDP)
+    int n_workers;   // MODE_THREADS: connections served at once
+    int queue_len;   // MODE_THREADS: accepted connections waiting for a worker
+    size_t stack_kb; // MODE_THREADS: worker stack size
+    int send_mode;   // Download send path (ZC_MODE_*), MODE_THREADS/MODE_EPOLL
+    int recv_mode;   // Upload discard method (DISCARD_*), MODE_THREADS/MODE_EPOLL
+    int capacity;    // Upload tests the results table holds at once
+    int ttl;         // Seconds an upload result waits for its client
+    int busy_poll;   // Latency echo spins, on its own CPU if one is free, instead of sleeping
+    size_t send_size; // Download bytes per send, from the shared payload
+    int payload_flags; // PAYLOAD_HUGEPAGES, PAYLOAD_RANDOM
+} server_opts_t;
+
+// MODE_THREADS handler state, preallocated by the worker pool
+typedef union server_task_ctx
+{
+    struct
+    {
+        int fd;
+        int send_mode;
+        results_table_t *results; // gets the TCP_INFO summary
+    } download;
+    srv_thread_arg_t upload;
+} server_task_ctx_t;
+
 typedef struct upload_worker_args
 {
-    results_lock_t *results_lock;
+    results_table_t *results;
+    worker_pool_t *pool;
+    int recv_mode;
 } upload_worker_args_t;
 
-// Upload server handler thread
+// Upload server accept thread
 static void *upload_worker(void *arg)
 {
     upload_worker_args_t *args = arg;
-    server_upload(N_CONN, T_SECONDS, args->results_lock);
+    server_upload(MAX_CONN, T_SECONDS, args->results, args->pool, args->recv_mode);
     return NULL;
 }
 
-static int create_listening_socket(const char *port)
+static int create_listening_socket(const char *port, int reuseport)
 {
     struct addrinfo hints = {0}, *res = NULL;
     hints.ai_family = AF_INET;
@@ -72,6 +119,14 @@ static int create_listening_socket(const char *port)
         return -1;
     }
 
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1)
+    {
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+
     if (bind(fd, res->ai_addr, res->ai_addrlen) == -1)
     {
         perror("bind");
@@ -92,50 +147,156 @@ static int create_listening_socket(const char *port)
     return fd;
 }
 
-static void *download_worker(void *arg)
+static void download_task(void *ctx)
 {
-    int client_fd = *(int *)arg;
-    free(arg);
+    server_task_ctx_t *task = ctx;
+    int client_fd = task->download.fd;
 
-    int rc = server_handle_download_client(client_fd);
+    int rc = server_handle_download_client(client_fd, task->download.send_mode, task->download.results);
     if (rc != DOWNLOAD_OK)
         fprintf(stderr, "download handler error: %d\n", rc);
 
     close(client_fd);
-    return NULL;
 }
 
-int main()
+static void usage(const char *prog)
 {
-    // Initicializo lista de resultados para los clientes
-    results_lock_t results_lock;
-    if (pthread_mutex_init(&results_lock.mutex, NULL) != 0)
+    fprintf(stderr, "Uso: %s [-m epoll|uring|threads] [-w loops] [-r] [-t workers] [-q queue] [-s stack_kb]\n"
+                    "          [-z copy|msg|sendfile] [-d auto|trunc|splice|read] [-c max_tests] [-e ttl_s] [-b]\n"
+                    "          [-S send_kb] [-H] [-P const|random]\n"
+                    "  -r: one SO_REUSEPORT listener pair per loop, loops pinned (epoll and uring only)\n"
+                    "  -b: busy-poll latency echo (burns one CPU per echo thread)\n"
+                    "  -H: payload on 2 MB huge pages\n"
+                    "  -P random: incompressible payload, for paths that compress\n", prog);
+}
+
+static int parse_opts(int argc, char *argv[], server_opts_t *opts)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    opts->mode = MODE_EPOLL;
+    opts->n_loops = ncpu > 0 ? (int)ncpu : 1;
+    opts->sharded = 0;
+    opts->n_workers = DEFAULT_WORKERS;
+    opts->queue_len = DEFAULT_QUEUE_LEN;
+    opts->stack_kb = DEFAULT_STACK_KB;
+    opts->send_mode = ZC_MODE_COPY;
+    opts->recv_mode = DISCARD_AUTO;
+    opts->capacity = RT_DEFAULT_CAPACITY;
+    opts->ttl = RT_DEFAULT_TTL;
+    opts->busy_poll = 0;
+    opts->send_size = PAYLOAD;
+    opts->payload_flags = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "m:w:rt:q:s:z:d:c:e:bS:HP:")) != -1)
     {
-        perror("pthread_mutex_init");
-        return EXIT_FAILURE;
+        switch (c)
+        {
+        case 'm':
+            if (strcmp(optarg, "epoll") == 0)
+                opts->mode = MODE_EPOLL;
+            else if (strcmp(optarg, "uring") == 0)
+                opts->mode = MODE_URING;
+            else if (strcmp(optarg, "threads") == 0)
+                opts->mode = MODE_THREADS;
+            else
+                return -1;
+            break;
+        case 'w':
+            opts->n_loops = atoi(optarg);
+            if (opts->n_loops < 1)
+                return -1;
+            break;
+        case 'r':
+            opts->sharded = 1;
+            break;
+        case 't':
+            opts->n_workers = atoi(optarg);
+            if (opts->n_workers < 1)
+                return -1;
+            break;
+        case 'q':
+            opts->queue_len = atoi(optarg);
+            if (opts->queue_len < 0)
+                return -1;
+            break;
+        case 's':
+        {
+            int kb = atoi(optarg);
+            if (kb < 1)
+                return -1;
+            opts->stack_kb = (size_t)kb;
+            break;
+        }
+        case 'z':
+            opts->send_mode = zc_mode_parse(optarg);
+            if (opts->send_mode < 0)
+                return -1;
+            break;
+        case 'd':
+            opts->recv_mode = discard_mode_parse(optarg);
+            if (opts->recv_mode < DISCARD_AUTO)
+                return -1;
+            break;
+        case 'c':
+            opts->capacity = atoi(optarg);
+            if (opts->capacity < 1)
+                return -1;
+            break;
+        case 'e':
+            opts->ttl = atoi(optarg);
+            if (opts->ttl < 1)
+                return -1;
+            break;
+        case 'b':
+            opts->busy_poll = 1;
+            break;
+        case 'S':
+            opts->send_size = (size_t)atoi(optarg) * 1024;
+            if (opts->send_size < 1 || opts->send_size > PAYLOAD_MAX_SEND)
+                return -1;
+            break;
+        case 'H':
+            opts->payload_flags |= PAYLOAD_HUGEPAGES;
+            break;
+        case 'P':
+        {
+            int fill = payload_mode_parse(optarg);
+            if (fill < 0)
+                return -1;
+            opts->payload_flags = (opts->payload_flags & ~PAYLOAD_RANDOM) | fill;
+            break;
+        }
+        default:
+            return -1;
+        }
     }
-
-    results_lock.results = calloc(MAX_CLIENTS, sizeof *results_lock.results);
-    if (!results_lock.results)
+    // The threaded server has one listener per port, accepted from one thread
+    if (opts->sharded && opts->mode == MODE_THREADS)
     {
-        perror("calloc");
-        pthread_mutex_destroy(&results_lock.mutex);
-        return EXIT_FAILURE;
+        fprintf(stderr, "server: -r shards the epoll and uring engines, not -m threads\n");
+        return -1;
     }
+    return 0;
+}
 
-    // Empiezo latency echo
-    pthread_t latency_thr;
-    echo_server_args_t echo_args = {.results_lock = &results_lock};
-    if (pthread_create(&latency_thr, NULL, latency_echo_server, &echo_args) != 0)
-    {
-        perror("pthread_create (latency thread)");
+// Blocking server: connections run on a bounded worker pool, uploads are
+// accepted on their own thread and downloads here
+static int run_threaded(const server_opts_t *opts, results_table_t *results)
+{
+    worker_pool_t pool;
+    pool_cfg_t pool_cfg = {
+        .n_workers = opts->n_workers,
+        .queue_len = opts->queue_len,
+        .ctx_size = sizeof(server_task_ctx_t),
+        .stack_size = opts->stack_kb * 1024};
+    if (pool_init(&pool, &pool_cfg) < 0)
         return EXIT_FAILURE;
-    }
-    pthread_detach(latency_thr);
+    printf("server: %d workers (%zu KB stacks), queue of %d\n",
+           pool.n_workers, opts->stack_kb, opts->queue_len);
 
-    // Ahora para upload
     pthread_t upload_thr;
-    upload_worker_args_t up_args = {.results_lock = &results_lock};
+    upload_worker_args_t up_args = {.results = results, .pool = &pool, .recv_mode = opts->recv_mode};
     if (pthread_create(&upload_thr, NULL, upload_worker, &up_args) != 0)
     {
         perror("pthread_create (upload thread)");
@@ -144,7 +305,7 @@ int main()
     pthread_detach(upload_thr);
 
     // Set up download service in main thread
-    int srv_fd = create_listening_socket(TCP_PORT_DOWN);
+    int srv_fd = create_listening_socket(TCP_PORT_DOWN, 0);
     if (srv_fd < 0)
         return EXIT_FAILURE;
 
@@ -167,26 +328,172 @@ int main()
         inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof ip);
         printf("server: download connection from %s\n", ip);
 
-        int *fd_ptr = malloc(sizeof *fd_ptr);
-        if (!fd_ptr)
+        server_task_ctx_t *ctx = pool_ctx_get(&pool);
+        if (!ctx)
         {
-            perror("malloc");
+            pool_print_stats(&pool, "server: worker pool full, rejecting download connection");
             close(cli_fd);
             continue;
         }
-        *fd_ptr = cli_fd;
+        ctx->download.fd = cli_fd;
+        ctx->download.send_mode = opts->send_mode;
+        ctx->download.results = results;
+        pool_submit(&pool, ctx, download_task);
+    }
+
+    close(srv_fd);
+    return EXIT_SUCCESS;
+}
+
+// Event-driven server: both TCP services on the same epoll/io_uring loops
+static int run_event_loops(const server_opts_t *opts, results_table_t *results)
+{
+    char up_port[8];
+    snprintf(up_port, sizeof up_port, "%d", TCP_PORT_UPLOAD);
+
+    int n = opts->n_loops;
+    int opened = 0; // listener pairs to close
+    int rc = -1;
+    int *down_fds = malloc(n * sizeof *down_fds);
+    int *up_fds = malloc(n * sizeof *up_fds);
+    if (!down_fds || !up_fds)
+    {
+        perror("malloc");
+        goto out;
+    }
 
-        pthread_t thr;
-        if (pthread_create(&thr, NULL, download_worker, fd_ptr) != 0)
+    // Sharded: one SO_REUSEPORT pair per loop. Otherwise all loops share one pair.
+    for (int i = 0; i < n; i++)
+    {
+        if (i > 0 && !opts->sharded)
         {
-            perror("pthread_create (worker)");
-            close(cli_fd);
-            free(fd_ptr);
+            down_fds[i] = down_fds[0];
+            up_fds[i] = up_fds[0];
             continue;
         }
-        pthread_detach(thr);
+        down_fds[i] = create_listening_socket(TCP_PORT_DOWN, opts->sharded);
+        up_fds[i] = create_listening_socket(up_port, opts->sharded);
+        opened++;
+        if (down_fds[i] < 0 || up_fds[i] < 0)
+            goto out;
     }
 
-    close(srv_fd);
-    return EXIT_SUCCESS;
+    event_loop_cfg_t cfg = {
+        .n_loops = n,
+        .down_fds = down_fds,
+        .up_fds = up_fds,
+        .sharded = opts->sharded,
+        .T = T_SECONDS,
+        .send_mode = opts->send_mode,
+        .recv_mode = opts->recv_mode,
+        .results = results};
+
+    printf("server: waiting for TCP connections on port %s (download) and port %d (upload)...\n",
+           TCP_PORT_DOWN, TCP_PORT_UPLOAD);
+
+    if (opts->mode == MODE_URING && opts->send_mode != ZC_MODE_COPY)
+        fprintf(stderr, "server: -z applies to the epoll and threads engines, io_uring sends from its registered buffer\n");
+    if (opts->mode == MODE_URING && opts->recv_mode != DISCARD_AUTO)
+        fprintf(stderr, "server: -d applies to the epoll and threads engines, io_uring receives into its buffer ring\n");
+
+    rc = opts->mode == MODE_URING ? uring_loop_run(&cfg) : URING_UNAVAILABLE;
+    if (rc == URING_UNAVAILABLE)
+    {
+        if (opts->mode == MODE_URING)
+            fprintf(stderr, "server: io_uring unavailable, falling back to epoll\n");
+        rc = event_loop_run(&cfg);
+    }
+
+out:
+    for (int i = 0; i < opened; i++)
+    {
+        if (down_fds[i] >= 0)
+            close(down_fds[i]);
+        if (up_fds[i] >= 0)
+            close(up_fds[i]);
+    }
+    free(down_fds);
+    free(up_fds);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    server_opts_t opts;
+    if (parse_opts(argc, argv, &opts) < 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    raise_fd_limit(); // clients may use up to MAX_CONN streams each
+
+    // io_uring registers the payload, and only writable memory can be registered
+    if (payload_init(opts.send_size, opts.payload_flags | (opts.mode == MODE_URING ? PAYLOAD_PINNABLE : 0)) < 0)
+        return EXIT_FAILURE;
+    char fill[32] = "constant";
+    if (payload_rng() >= 0)
+        snprintf(fill, sizeof fill, "random (%s)", payload_rng_name(payload_rng()));
+    printf("server: %s payload of %zu KB per send, %zu KB on %s pages\n", fill, payload_send_size() / 1024,
+           payload_len() / 1024, payload_backing());
+
+    int send_mode = zc_init(opts.send_mode);
+    if (send_mode < 0)
+        return EXIT_FAILURE;
+    if (send_mode != opts.send_mode)
+        fprintf(stderr, "server: -z %s unavailable, using %s\n",
+                zc_mode_name(opts.send_mode), zc_mode_name(send_mode));
+    opts.send_mode = send_mode;
+    printf("server: download send mode: %s\n", zc_mode_name(send_mode));
+
+    // Initicializo lista de resultados para los clientes
+    results_table_t results;
+    if (opts.ttl <= T_SECONDS)
+        fprintf(stderr, "server: results TTL (%d s) is not longer than a test (%d s)\n", opts.ttl, T_SECONDS);
+    if (rt_init(&results, opts.capacity, opts.ttl) < 0)
+        return EXIT_FAILURE;
+    printf("server: results table for %d concurrent tests, kept %d s\n", opts.capacity, opts.ttl);
+
+    // Empiezo latency echo: sharded, one SO_REUSEPORT socket and thread per loop.
+    // Pinned loops take the first CPUs; echo threads are pinned after them, or
+    // not at all if there are not enough: never onto a transfer loop's CPU
+    int n_echo = opts.sharded ? opts.n_loops : 1;
+    int loop_cpus = opts.sharded && opts.mode != MODE_THREADS ? opts.n_loops : 0;
+    int pin_echo = (opts.sharded || opts.busy_poll) && loop_cpus + n_echo <= cpu_count();
+    if ((opts.sharded || opts.busy_poll) && !pin_echo)
+        fprintf(stderr, "server: %d CPU(s) for %d loop(s) and %d echo thread(s): echo threads left unpinned\n",
+                cpu_count(), loop_cpus, n_echo);
+    echo_server_args_t *echo_args = calloc(n_echo, sizeof *echo_args);
+    if (!echo_args)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < n_echo; i++)
+    {
+        echo_args[i].results = &results;
+        echo_args[i].reuseport = opts.sharded;
+        echo_args[i].busy_poll = opts.busy_poll;
+
+        // A busy-poll thread must keep its CPU: migrations would add the noise it avoids
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        int cpu = pin_echo ? cpu_by_index(loop_cpus + i) : -1;
+        if (cpu >= 0 && thread_attr_pin(&attr, cpu) != 0)
+            fprintf(stderr, "latency thread %d: cannot pin to CPU %d\n", i, cpu);
+
+        pthread_t latency_thr;
+        int rc = pthread_create(&latency_thr, &attr, latency_echo_server, &echo_args[i]);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            perror("pthread_create (latency thread)");
+            return EXIT_FAILURE;
+        }
+        pthread_detach(latency_thr);
+    }
+
+    if (opts.mode == MODE_THREADS)
+        return run_threaded(&opts, &results);
+    return run_event_loops(&opts, &results);
 }
@@ -0,0 +1,114 @@
+#include "tcpinfo.h"
+#include <linux/tcp.h> // struct tcp_info with the rate and limited fields
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+void tcpi_init(tcp_summary_t *s)
+{
+    memset(s, 0, sizeof *s);
+}
+
+int tcpi_sample(int fd, tcp_summary_t *s)
+{
+    struct tcp_info ti;
+    socklen_t len = sizeof ti;
+    memset(&ti, 0, sizeof ti); // older kernels fill in less
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+        return -1;
+
+    if (s->samples == 0 || ti.tcpi_snd_cwnd < s->cwnd_min)
+        s->cwnd_min = ti.tcpi_snd_cwnd;
+    if (ti.tcpi_snd_cwnd > s->cwnd_max)
+        s->cwnd_max = ti.tcpi_snd_cwnd;
+    if (s->samples == 0 || ti.tcpi_rtt < s->srtt_min_us)
+        s->srtt_min_us = ti.tcpi_rtt;
+    if (ti.tcpi_rtt > s->srtt_max_us)
+        s->srtt_max_us = ti.tcpi_rtt;
+    if (ti.tcpi_delivery_rate > s->delivery_rate_max)
+        s->delivery_rate_max = ti.tcpi_delivery_rate;
+    s->samples++;
+    s->cwnd_sum += ti.tcpi_snd_cwnd;
+    s->srtt_sum_us += ti.tcpi_rtt;
+    s->rttvar_sum_us += ti.tcpi_rttvar;
+    s->pacing_rate_sum += ti.tcpi_pacing_rate == UINT64_MAX ? 0 : ti.tcpi_pacing_rate; // ~0: no pacing
+    s->delivery_rate_sum += ti.tcpi_delivery_rate;
+
+    // Cumulative in the kernel: the last sample has the whole connection
+    s->retrans = ti.tcpi_total_retrans;
+    s->busy_us = ti.tcpi_busy_time;
+    s->rwnd_limited_us = ti.tcpi_rwnd_limited;
+    s->sndbuf_limited_us = ti.tcpi_sndbuf_limited;
+    return 0;
+}
+
+void tcpi_merge(tcp_summary_t *dst, const tcp_summary_t *src)
+{
+    if (src->samples == 0)
+        return;
+    if (dst->samples == 0 || src->cwnd_min < dst->cwnd_min)
+        dst->cwnd_min = src->cwnd_min;
+    if (src->cwnd_max > dst->cwnd_max)
+        dst->cwnd_max = src->cwnd_max;
+    if (dst->samples == 0 || src->srtt_min_us < dst->srtt_min_us)
+        dst->srtt_min_us = src->srtt_min_us;
+    if (src->srtt_max_us > dst->srtt_max_us)
+        dst->srtt_max_us = src->srtt_max_us;
+    if (src->delivery_rate_max > dst->delivery_rate_max)
+        dst->delivery_rate_max = src->delivery_rate_max;
+    dst->samples += src->samples;
+    dst->cwnd_sum += src->cwnd_sum;
+    dst->srtt_sum_us += src->srtt_sum_us;
+    dst->rttvar_sum_us += src->rttvar_sum_us;
+    dst->pacing_rate_sum += src->pacing_rate_sum;
+    dst->delivery_rate_sum += src->delivery_rate_sum;
+    dst->retrans += src->retrans;
+    dst->busy_us += src->busy_us;
+    dst->rwnd_limited_us += src->rwnd_limited_us;
+    dst->sndbuf_limited_us += src->sndbuf_limited_us;
+}
+
+static double avg(uint64_t sum, uint32_t n)
+{
+    return n ? (double)sum / n : 0.0;
+}
+
+double tcpi_rwnd_limited(const tcp_summary_t *s)
+{
+    return s->busy_us ? (double)s->rwnd_limited_us / s->busy_us : 0.0;
+}
+
+double tcpi_sndbuf_limited(const tcp_summary_t *s)
+{
+    return s->busy_us ? (double)s->sndbuf_limited_us / s->busy_us : 0.0;
+}
+
+void tcpi_print(const tcp_summary_t *s, const char *what)
+{
+    if (s->samples == 0)
+    {
+        printf("%s: no TCP_INFO samples\n", what);
+        return;
+    }
+    printf("%s: cwnd %u/%.0f/%u, srtt %.3f/%.3f/%.3f ms (rttvar %.3f), retrans %u, "
+           "pacing %.1f Mb/s, delivery %.1f/%.1f Mb/s, rwnd-limited %.1f%%, sndbuf-limited %.1f%%\n",
+           what, s->cwnd_min, avg(s->cwnd_sum, s->samples), s->cwnd_max, s->srtt_min_us / 1e3,
+           avg(s->srtt_sum_us, s->samples) / 1e3, s->srtt_max_us / 1e3, avg(s->rttvar_sum_us, s->samples) / 1e3,
+           s->retrans, avg(s->pacing_rate_sum, s->samples) * 8 / 1e6, avg(s->delivery_rate_sum, s->samples) * 8 / 1e6,
+           s->delivery_rate_max * 8 / 1e6, tcpi_rwnd_limited(s) * 100, tcpi_sndbuf_limited(s) * 100);
+}
+
+int tcpi_json(const tcp_summary_t *s, char *buf, size_t size)
+{
+    return snprintf(buf, size,
+                    "{\"samples\": %u,\"cwnd_min\": %u,\"cwnd_avg\": %.1f,\"cwnd_max\": %u,"
+                    "\"srtt_min\": %.6f,\"srtt_avg\": %.6f,\"srtt_max\": %.6f,\"rttvar_avg\": %.6f,"
+                    "\"retrans\": %u,\"pacing_rate_bps\": %.0f,\"delivery_rate_bps\": %.0f,"
+                    "\"delivery_rate_max_bps\": %.0f,\"busy\": %.3f,\"rwnd_limited\": %.3f,\"sndbuf_limited\": %.3f}",
+                    s->samples, s->cwnd_min, avg(s->cwnd_sum, s->samples), s->cwnd_max, s->srtt_min_us / 1e6,
+                    avg(s->srtt_sum_us, s->samples) / 1e6, s->srtt_max_us / 1e6,
+                    avg(s->rttvar_sum_us, s->samples) / 1e6, s->retrans, avg(s->pacing_rate_sum, s->samples) * 8,
+                    avg(s->delivery_rate_sum, s->samples) * 8, s->delivery_rate_max * 8.0, s->busy_us / 1e6,
+                    s->rwnd_limited_us / 1e6, s->sndbuf_limited_us / 1e6);
+}
@@ -0,0 +1,82 @@
+#ifndef TCPINFO_H
+#define TCPINFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TCPI_INTERVAL_MS 100 // TCP_INFO sampling period of every connection
+
+/**
+ * @brief What TCP_INFO said about one connection over its life.
+ *
+ * Gauges (cwnd, srtt, rates) are summarized as min/avg/max over the
+ * samples; counters the kernel keeps since the connection started
+ * (retransmits, busy and limited times) are taken from the last sample.
+ * The limited times are only filled in on the sending side: compare them
+ * with busy_us to tell a receiver-window or send-buffer limit from a
+ * congestion-window (path) limit.
+ */
+typedef struct tcp_summary
+{
+    uint32_t samples;
+    uint32_t cwnd_min, cwnd_max; // segments
+    uint64_t cwnd_sum;
+    uint32_t srtt_min_us, srtt_max_us;
+    uint64_t srtt_sum_us;
+    uint64_t rttvar_sum_us;
+    uint32_t retrans; // segments retransmitted
+    uint64_t pacing_rate_sum; // bytes/s
+    uint64_t delivery_rate_sum; // bytes/s
+    uint64_t delivery_rate_max;
+    uint64_t busy_us;           // time with data in flight
+    uint64_t rwnd_limited_us;   // ... stalled on the peer's receive window
+    uint64_t sndbuf_limited_us; // ... stalled on our send buffer
+    double next_at; // seconds since the start of the connection of the next sample
+} tcp_summary_t;
+
+void tcpi_init(tcp_summary_t *s);
+
+/**
+ * @brief Takes one TCP_INFO sample of fd into s.
+ *
+ * @return int 0, or -1 if getsockopt() failed (not a TCP socket, closed).
+ */
+int tcpi_sample(int fd, tcp_summary_t *s);
+
+/**
+ * @brief Samples fd if TCPI_INTERVAL_MS went by since the last sample.
+ *
+ * Cheap enough for every send or recv loop iteration: a compare unless a
+ * sample is due.
+ *
+ * @param elapsed Seconds since the connection started.
+ */
+static inline void tcpi_poll(int fd, tcp_summary_t *s, double elapsed)
+{
+    if (elapsed >= s->next_at)
+    {
+        tcpi_sample(fd, s);
+        s->next_at = elapsed + TCPI_INTERVAL_MS / 1000.0;
+    }
+}
+
+// Adds src into dst: the result summarizes both connections together
+void tcpi_merge(tcp_summary_t *dst, const tcp_summary_t *src);
+
+// Share of the busy time stalled on the receive window / send buffer, 0..1
+double tcpi_rwnd_limited(const tcp_summary_t *s);
+double tcpi_sndbuf_limited(const tcp_summary_t *s);
+
+// One line: "<what>: cwnd ..., srtt ..., retrans ..., ..."
+void tcpi_print(const tcp_summary_t *s, const char *what);
+
+#define TCPI_JSON_MAX 512 // longest object tcpi_json() writes, with room to spare
+
+/**
+ * @brief Writes s as a JSON object ({"samples": ..., "cwnd_avg": ...}).
+ *
+ * @return int Characters written, as snprintf().
+ */
+int tcpi_json(const tcp_summary_t *s, char *buf, size_t size);
+
+#endif // TCPINFO_H
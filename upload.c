@@ -1,4 +1,5 @@
 #include <arpa/inet.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,45 +12,114 @@
 #include "upload.h"
 #include "handle_result.h"
 #include "config.h"
+#include "discard.h"
+#include "adaptive.h"
+#include "ramp.h"
+#include "deadline.h"
 #include <unistd.h>
 
 void *upload_server_thread(void *arg)
 {
   srv_thread_arg_t *args = arg;
-  pthread_mutex_lock(&args->res_mutex->mutex);
-  *(args->bytes_recv) = 6;
-  pthread_mutex_unlock(&args->res_mutex->mutex);
 
-  // Leer datos hasta que se cumpla el tiempo T o se cierre la conexión
-  uint8_t buf[MAX_PAYLOAD];
-  struct timespec now;
-  while (1)
+  // Leer datos hasta que se cumpla el tiempo T o se cierre la conexión;
+  // sólo se cuentan, el descarte evita copiarlos a espacio de usuario
+  discard_t sink;
+  if (discard_init(&sink, args->recv_mode) < 0)
   {
-    now = now_ts();
-    if (diff_ts(&args->start, &now) >= args->T)
-    {
-      break;
-    }
-
-    ssize_t r = recv(args->conn_fd, buf, sizeof(buf), 0);
+    close(args->conn_fd);
+    return NULL;
+  }
+  discard_prepare_socket(&sink, args->conn_fd);
+  tcp_summary_t tcp;
+  tcpi_init(&tcp);
+  uint64_t bytes = UPLOAD_HEADER_LEN;
+  // El temporizador cierra la lectura al cumplirse T: el recv() devuelve 0
+  deadline_t deadline;
+  if (dl_arm(&deadline, &args->start, args->T, args->conn_fd, SHUT_RD) < 0)
+  {
+    discard_destroy(&sink);
+    rt_release(args->results, args->entry, args->counter);
+    close(args->conn_fd);
+    return NULL;
+  }
+  while (!dl_expired(&deadline))
+  {
+    ssize_t r = discard_recv(&sink, args->conn_fd, 0);
     if (r <= 0)
     {
       break;
     }
 
-    pthread_mutex_lock(&args->res_mutex->mutex);
-    *(args->bytes_recv) += r;
-    *(args->duration) = diff_ts(&args->start, &now);
-    pthread_mutex_unlock(&args->res_mutex->mutex);
+    bytes += r;
+    double elapsed = dl_elapsed(&args->start);
+    conn_counter_publish(args->counter, bytes, elapsed);
+    tcpi_poll(args->conn_fd, &tcp, elapsed);
   }
+  dl_cancel(&deadline);
+  // El reloj del temporizador va hasta DL_TICK_MS atrasado: la duración final es exacta
+  struct timespec now = now_ts();
+  double duration = diff_ts(&args->start, &now);
+  conn_counter_publish(args->counter, bytes, duration < args->T ? duration : args->T);
+  discard_destroy(&sink);
+  tcpi_sample(args->conn_fd, &tcp);
+  char what[64];
+  snprintf(what, sizeof what, "server: upload TCP (fd: %d)", args->conn_fd);
+  tcpi_print(&tcp, what);
+  rt_release(args->results, args->entry, args->counter);
   close(args->conn_fd);
   return NULL;
 }
 
-int server_upload(int N, int T, results_lock_t *results_lock)
+int upload_claim_slot(results_table_t *results, const uint8_t header[UPLOAD_HEADER_LEN], int fd,
+                      rt_entry_t **entry, conn_counter_t **counter)
+{
+  uint32_t test_id;
+  memcpy(&test_id, header, 4);
+  uint16_t conn_id;
+  memcpy(&conn_id, header + 4, 2);
+
+  uint16_t client_conn = ntohs(conn_id);
+  if (client_conn < 1 || client_conn > MAX_CONN)
+  {
+    fprintf(stderr, "Invalid connection id %u\n", client_conn);
+    return UPLOAD_STATUS_BAD_HEADER;
+  }
+
+  // Cualquier sub-conexión crea el test si todavía no existe
+  int rc = rt_claim(results, test_id, client_conn - 1, fd, entry, counter);
+  if (rc == RT_REPORTED)
+  {
+    fprintf(stderr, "Connection %u arrived after its test was reported, rejecting it\n", client_conn);
+    return UPLOAD_STATUS_REPORTED;
+  }
+  if (rc != RT_OK)
+  {
+    fprintf(stderr, "Results table full, rejecting test\n");
+    return UPLOAD_STATUS_FULL;
+  }
+
+  // El header cuenta como datos recibidos
+  conn_counter_publish(*counter, UPLOAD_HEADER_LEN, 0.0);
+  return UPLOAD_STATUS_OK;
+}
+
+int upload_send_status(int fd, uint8_t status)
+{
+  return send(fd, &status, 1, MSG_NOSIGNAL | MSG_DONTWAIT) == 1 ? 0 : -1;
+}
+
+static void upload_server_task(void *ctx)
+{
+  // El reloj arranca cuando un worker toma la conexión: el tiempo en cola no cuenta contra T
+  srv_thread_arg_t *args = ctx;
+  args->start = now_ts();
+  upload_server_thread(args);
+}
+
+int server_upload(int N, int T, results_table_t *results, worker_pool_t *pool, int recv_mode)
 {
-  struct BW_result *bw_results = results_lock->results;
-  printf("server: starting upload test with %d connections for %d seconds...\n",
+  printf("server: starting upload test with up to %d connections per test for %d seconds...\n",
          N, T);
 
   int sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -96,85 +166,40 @@ int server_upload(int N, int T, results_lock_t *results_lock)
       perror("accept");
       continue;
     }
-    struct timespec start = now_ts();
 
-    uint8_t header[6];
-    ssize_t r = recv(conn_fd, header, sizeof(header), 0);
-    if (r < 0)
+    uint8_t header[UPLOAD_HEADER_LEN];
+    ssize_t r = recv(conn_fd, header, sizeof(header), MSG_WAITALL);
+    if (r != sizeof(header))
     {
-      perror("recv header");
+      if (r < 0)
+        perror("recv header");
       close(conn_fd);
       continue;
     }
 
-    srv_thread_arg_t *thread_args = malloc(sizeof(*thread_args));
+    srv_thread_arg_t *thread_args = pool_ctx_get(pool);
     if (!thread_args)
     {
-      perror("malloc");
+      pool_print_stats(pool, "server: worker pool full, rejecting upload connection");
       close(conn_fd);
       continue;
     }
 
-    uint32_t test_id;
-    memcpy(&test_id, header, 4);
-    uint16_t conn_id;
-    memcpy(&conn_id, header + 4, 2);
-
-    pthread_mutex_lock(&results_lock->mutex);
-    int idx = -1;
-
-    uint16_t client_conn = ntohs(conn_id);
-    if (client_conn == 1)
-    {
-      // first sub-connection: grab a free slot
-      for (int i = 0; i < MAX_CLIENTS * N; i++)
-      {
-        if (bw_results[i].id_measurement == 0)
-        {
-          idx = i;
-          bw_results[i].id_measurement = test_id;
-          break;
-        }
-      }
-      if (idx < 0)
-      {
-        fprintf(stderr, "No free slot for new test\n");
-      }
-    }
-    else
+    uint8_t status = upload_claim_slot(results, header, conn_fd, &thread_args->entry, &thread_args->counter);
+    upload_send_status(conn_fd, status);
+    if (status != UPLOAD_STATUS_OK)
     {
-      // subsequent sub-connections: find the same slot
-      for (int i = 0; i < MAX_CLIENTS * N; i++)
-      {
-        if (bw_results[i].id_measurement == test_id)
-        {
-          idx = i;
-
-          break;
-        }
-      }
-      if (idx < 0)
-      {
-        fprintf(stderr, "Cannot find slot for existing test\n");
-      }
+      pool_ctx_put(pool, thread_args);
+      close(conn_fd);
+      continue;
     }
-    pthread_mutex_unlock(&results_lock->mutex);
 
     thread_args->conn_fd = conn_fd;
-    thread_args->bytes_recv = &(bw_results[idx].conn_bytes[client_conn - 1]);
-    thread_args->duration = &(bw_results[idx].conn_duration[client_conn - 1]);
-    thread_args->start = start;
     thread_args->T = T;
-    thread_args->res_mutex = results_lock;
+    thread_args->recv_mode = recv_mode;
+    thread_args->results = results;
 
-    pthread_t thread;
-    if (pthread_create(&thread, NULL, upload_server_thread, thread_args) != 0)
-    {
-      fprintf(stderr, "Error creating upload server thread\n");
-      free(thread_args);
-      close(conn_fd);
-      continue;
-    }
+    pool_submit(pool, thread_args, upload_server_task);
   }
 }
 
@@ -182,33 +207,148 @@ void *upload_client_thread(void *arg)
 {
   cli_thread_arg_t *args = arg;
 
-  // Enviar header
+  // Enviar header y esperar el estado: el servidor puede rechazar el test
+  args->status = -1;
+  tcpi_init(&args->tcp);
   send(args->sockfd, args->header, sizeof(args->header), 0);
-
-  // Crear y llenar buffer de datos
-  uint8_t *buf = malloc(args->buf_size);
-  if (!buf)
+  uint8_t status;
+  if (recv(args->sockfd, &status, 1, 0) != 1)
+  {
+    __atomic_store_n(&args->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+  }
+  args->status = status;
+  if (status != UPLOAD_STATUS_OK)
   {
-    perror("malloc");
+    __atomic_store_n(&args->done, 1, __ATOMIC_RELEASE);
     return NULL;
   }
-  memset(buf, 0xAA, args->buf_size);
 
-  // Enviar datos en bucle
-  while (1)
+  // Enviar el payload compartido en bucle hasta que el servidor cierre
+  zc_sender_t zc;
+  zc_sender_init(&zc, args->sockfd, args->send_mode);
+  struct timespec start = now_ts();
+  int clock_held = dl_hold() == 0; // sin reloj no hay muestras de TCP_INFO
+  uint64_t total = 0;
+  while (!args->stop || !__atomic_load_n(args->stop, __ATOMIC_ACQUIRE))
   {
-    if (send(args->sockfd, buf, args->buf_size, MSG_NOSIGNAL) <= 0)
+    if (clock_held)
+      tcpi_poll(args->sockfd, &args->tcp, dl_elapsed(&start));
+    ssize_t n = zc_send(&zc, MSG_NOSIGNAL);
+    if (n == 0)
+    {
+      // El servidor cerró: errno no dice nada aquí
+      break;
+    }
+    if (n < 0)
     {
+      if (errno == EAGAIN || errno == EINTR)
+      {
+        continue;
+      }
       break;
     }
+    total += n;
+    __atomic_store_n(&args->bytes, total, __ATOMIC_RELAXED);
   }
 
-  free(buf);
+  if (clock_held)
+    dl_release();
+  zc_sender_finish(&zc, 0);
+  tcpi_sample(args->sockfd, &args->tcp);
+  __atomic_store_n(&args->done, 1, __ATOMIC_RELEASE);
   return NULL;
 }
 
-int client_upload(const char *srv_ip, int N, struct BW_result *bw_result)
+// El texto trae una línea por conexión del servidor, que puede haber visto
+// menos que N: se desempaqueta aparte y se copia a las primeras de bw_result
+static int unpack_text_result(struct BW_result *bw_result, uint8_t *buf, int len, int n_conn)
+{
+  struct BW_result text;
+  if (initBwResult(&text, n_conn) < 0)
+    return -1;
+  int n = unpackResultPayload(&text, buf, len);
+  if (n >= 0)
+  {
+    bw_result->id_measurement = text.id_measurement;
+    memcpy(bw_result->conn_bytes, text.conn_bytes, n_conn * sizeof *text.conn_bytes);
+    memcpy(bw_result->conn_duration, text.conn_duration, n_conn * sizeof *text.conn_duration);
+    n = n_conn; // una sola respuesta con todas las conexiones
+  }
+  freeBwResult(&text);
+  return n;
+}
+
+// Pide los resultados del test: 4 bytes (texto) o test_id + versión (binario)
+static int send_results_request(int udp_sock, const struct sockaddr_in *udp_srv,
+                                const uint8_t test_id[4], int format)
+{
+  uint8_t req[5];
+  memcpy(req, test_id, 4);
+  req[4] = (uint8_t)format;
+  size_t req_len = format == RESULT_FMT_TEXT ? 4 : sizeof(req);
+  if (sendto(udp_sock, req, req_len, 0, (const struct sockaddr *)udp_srv, sizeof(*udp_srv)) < 0)
+  {
+    perror("sendto UDP failed"); // <-- this will print the errno reason
+    fprintf(stderr, "  target is %s:%d\n",
+            inet_ntoa(udp_srv->sin_addr),
+            ntohs(udp_srv->sin_port));
+    return -1;
+  }
+  return 0;
+}
+
+// Bytes enviados por todos los hilos; devuelve cuántos siguen enviando
+static int upload_sample(void *ctx, uint64_t *bytes)
+{
+  cli_thread_arg_t *args = ctx;
+  int running = 0;
+  *bytes = 0;
+  for (int i = 0; args[i].sockfd >= 0; i++)
+  {
+    *bytes += __atomic_load_n(&args[i].bytes, __ATOMIC_RELAXED);
+    running += !__atomic_load_n(&args[i].done, __ATOMIC_ACQUIRE);
+  }
+  return running;
+}
+
+// Una sola vez por proceso: re-sembrar en cada llamada repetía el id dentro del mismo segundo
+static pthread_once_t test_id_once = PTHREAD_ONCE_INIT;
+
+static void seed_test_id(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  srand((unsigned)t.tv_sec ^ (unsigned)t.tv_nsec ^ ((unsigned)getpid() << 16));
+}
+
+void new_test_id(uint8_t test_id[4])
+{
+  pthread_once(&test_id_once, seed_test_id);
+  do
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      test_id[i] = (uint8_t)rand();
+    }
+  } while (test_id[0] == 0xFF);
+}
+
+void fill_header(uint8_t header[UPLOAD_HEADER_LEN], const uint8_t test_id[4], int stream)
+{
+  memcpy(header, test_id, 4);
+  uint16_t cid = htons(stream + 1);
+  memcpy(header + 4, &cid, 2);
+}
+
+int client_upload(const char *srv_ip, const uint8_t test_id[4], int N, struct BW_result *bw_result, int send_mode,
+                  tcp_summary_t *tcp, double adapt_tol, int verbose)
 {
+  if (N < 1 || N > MAX_CONN)
+  {
+    fprintf(stderr, "client: upload needs 1 to %d connections, not %d\n", MAX_CONN, N);
+    return -1;
+  }
   printf("client: starting upload test to %s:%d with %d connections...\n",
          srv_ip, TCP_PORT_UPLOAD, N);
   struct sockaddr_in srv_addr = {
@@ -216,72 +356,119 @@ int client_upload(const char *srv_ip, int N, struct BW_result *bw_result)
       .sin_port = htons(TCP_PORT_UPLOAD)};
   inet_pton(AF_INET, srv_ip, &srv_addr.sin_addr);
 
-  // Crear y conectar N sockets TCP
-  int socks[N];
-  for (int i = 0; i < N; i++)
+  // En el heap: con MAX_CONN streams no caben en la pila del hilo
+  int *socks = malloc(N * sizeof *socks);
+  pthread_t *threads = malloc(N * sizeof *threads);
+  cli_thread_arg_t *args = calloc(N + 1, sizeof *args); // args[N].sockfd = -1 cierra la lista para upload_sample
+  if (!socks || !threads || !args)
   {
-    printf("client: creating socket %d...\n", i);
-    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
-    if (socks[i] < 0)
-    {
-      printf("Error creating socket %d\n", i);
-      die("socket()");
-    }
-    if (connect(socks[i], (struct sockaddr *)&srv_addr,
-                sizeof(srv_addr)) < 0)
-    {
-      printf("Error connecting socket %d\n", i);
-      die("connect()");
-    }
+    perror("malloc (upload streams)");
+    free(socks);
+    free(threads);
+    free(args);
+    return -1;
   }
 
-  printf("client: connected %d sockets to server %s:%d\n",
-         N, srv_ip, TCP_PORT_UPLOAD);
-  // Generar test_id aleatorio
-  srand(time(NULL) ^ getpid()); // Seed with current time and PID for more randomness
-  uint8_t test_id[4];
-  do
+  // Crear y conectar N sockets TCP; si uno falla, el test sigue con los anteriores
+  int requested = N;
+  for (int i = 0; i < requested; i++)
   {
-    for (int i = 0; i < 4; i++)
+    if (verbose)
+      printf("client: creating socket %d...\n", i);
+    socks[i] = socket(AF_INET, SOCK_STREAM, 0);
+    if (socks[i] < 0 || connect(socks[i], (struct sockaddr *)&srv_addr, sizeof(srv_addr)) < 0)
     {
-      test_id[i] = (uint8_t)rand();
+      fprintf(stderr, "client: upload connection %d: %s\n", i + 1, strerror(errno));
+      if (socks[i] >= 0)
+        close(socks[i]);
+      N = i;
+      break;
     }
-  } while (test_id[0] == 0xFF);
+  }
+  if (tcp)
+    for (int i = N; i < requested; i++)
+      tcpi_init(&tcp[i]); // los que no conectaron quedan vacíos
+  if (N == 0)
+  {
+    free(socks);
+    free(threads);
+    free(args);
+    return -1;
+  }
 
-  // Lanzar hilos de subida
-  pthread_t threads[N];
-  cli_thread_arg_t args[N];
+  printf("client: connected %d of %d sockets to server %s:%d\n",
+         N, requested, srv_ip, TCP_PORT_UPLOAD);
 
+  // Lanzar hilos de subida
+  int stop = 0;
+  int started = 0;
   for (int i = 0; i < N; i++)
   {
-    uint8_t header[6];
-    memcpy(header, test_id, 4);
-    uint16_t cid = htons(i + 1);
-    memcpy(header + 4, &cid, 2);
-    memcpy(args[i].header, header, 6);
+    uint8_t *header = args[i].header;
+    fill_header(header, test_id, i);
 
     args[i].sockfd = socks[i];
-    args[i].buf_size = MAX_PAYLOAD;
+    args[i].send_mode = send_mode;
+    args[i].stop = adapt_tol > 0 ? &stop : NULL;
 
     if (pthread_create(&threads[i], NULL,
                        upload_client_thread,
                        &args[i]) != 0)
     {
       fprintf(stderr, "Error creating upload client thread %d\n", i);
-      die("pthread_create()");
+      break;
     }
-    printf("client: started upload thread %d with header %02X%02X%02X%02X%02X%02X\n",
-           i, header[0], header[1], header[2], header[3], header[4], header[5]);
+    started++;
+    if (verbose)
+      printf("client: started upload thread %d with header %02X%02X%02X%02X%02X%02X\n",
+             i, header[0], header[1], header[2], header[3], header[4], header[5]);
   }
+  // Los que no arrancaron no mandan su header: el servidor nunca los ve
+  for (int i = started; i < N; i++)
+  {
+    close(socks[i]);
+    if (tcp)
+      tcpi_init(&tcp[i]);
+  }
+  N = started;
+  args[N].sockfd = -1;
+
+  // Modo adaptativo: cortar en cuanto la tasa converge; al cerrar, el
+  // servidor ve el fin de la conexión y cuenta hasta ahí
+  if (adapt_tol > 0)
+    adapt_watch(adapt_tol, T_SECONDS, upload_sample, args, &stop);
 
   // Esperar a que terminen los hilos
   for (int i = 0; i < N; i++)
   {
     pthread_join(threads[i], NULL);
     close(socks[i]);
+    if (tcp)
+      tcp[i] = args[i].tcp;
   }
 
   printf("client: all upload threads completed\n");
+  zc_print_stats(NULL, "client: upload payload");
+
+  int status = UPLOAD_STATUS_OK, rejected = 0;
+  for (int i = 0; i < N && status == UPLOAD_STATUS_OK; i++)
+  {
+    status = args[i].status;
+    rejected = i + 1;
+  }
+  free(socks);
+  free(threads);
+  free(args);
+  if (status == UPLOAD_STATUS_FULL)
+  {
+    fprintf(stderr, "client: server results table is full, try again later\n");
+    return -1;
+  }
+  if (status != UPLOAD_STATUS_OK)
+  {
+    fprintf(stderr, "client: upload connection %d rejected by server (status %d)\n", rejected, status);
+    return -1;
+  }
 
   // --- Fase UDP: solicitar resultados al servidor ---
   int udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -300,39 +487,113 @@ int client_upload(const char *srv_ip, int N, struct BW_result *bw_result)
   printf("Consulto resultados al servidor UDP %s:%d\n",
          srv_ip, UDP_PORT_RESULTS);
 
-  // Enviar test_id
-  ssize_t sent = sendto(udp_sock, test_id, sizeof(test_id), 0,
-                        (struct sockaddr *)&udp_srv, sizeof(udp_srv));
-  if (sent < 0)
+  // Pedir el formato binario; un servidor antiguo ignora la petición de
+  // 5 bytes, así que tras el timeout se repite con la de 4 (texto)
+  struct timeval tv = {.tv_sec = RESULTS_TIMEOUT_S, .tv_usec = 0};
+  setsockopt(udp_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  if (initBwResult(bw_result, N) < 0)
   {
-    perror("sendto UDP failed"); // <-- this will print the errno reason
-    fprintf(stderr, "  target is %s:%d\n",
-            inet_ntoa(udp_srv.sin_addr),
-            ntohs(udp_srv.sin_port));
+    fprintf(stderr, "Error allocating results for %d connections\n", N);
     close(udp_sock);
     return -1;
   }
-  // Recibir resultados
-  uint8_t buf[MAX_PAYLOAD];
-  socklen_t addr_len = sizeof(udp_srv);
-  ssize_t r = recvfrom(udp_sock, buf, sizeof(buf), 0,
-                       (struct sockaddr *)&udp_srv,
-                       &addr_len);
-  if (r < 0)
+  uint32_t expected_id;
+  memcpy(&expected_id, test_id, sizeof(expected_id));
+
+  // Las series llegan en ráfaga, un datagrama por conexión
+  int rcvbuf = N * 2 * RESULT_SERIES_SIZE(TS_SLOTS);
+  setsockopt(udp_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  // Los resultados llegan en uno o más datagramas, en cualquier orden
+  uint8_t got_chunk[MAX_CONN / RESULT_CHUNK_CONNS] = {0};
+  int received = 0; // conexiones ya recibidas
+  int series_expected = 0, series_received = 0;
+  int tcp_expected = 0, tcp_received = 0; // v4: el resumen de las descargas, opcional
+  int datagrams = 0;
+  int format = RESULT_FMT_LATEST;
+  int streams = N; // los que vio el servidor; los demás nunca llegaron y quedan en cero
+  if (send_results_request(udp_sock, &udp_srv, test_id, format) < 0)
+    goto fail;
+  while (received < streams || (series_expected && series_received < streams) || tcp_expected > tcp_received)
   {
-    die("recvfrom UDP");
-  }
+    uint8_t buf[MAX_PAYLOAD];
+    ssize_t r = recv(udp_sock, buf, sizeof(buf), 0);
+    if (r < 0 && received == streams)
+    {
+      // Las series y el resumen son opcionales: lo que se perdió queda vacío
+      if (series_expected && series_received < streams)
+        fprintf(stderr, "client: %d of %d upload series lost\n", streams - series_received, streams);
+      if (tcp_expected > tcp_received)
+        fprintf(stderr, "client: server download summary lost\n");
+      break;
+    }
+    if (r < 0)
+    {
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) && received == 0 && format != RESULT_FMT_TEXT)
+      {
+        format = RESULT_FMT_TEXT;
+        if (send_results_request(udp_sock, &udp_srv, test_id, format) < 0)
+          goto fail;
+        continue;
+      }
+      perror("recv UDP results");
+      fprintf(stderr, "  received %d of %d connection results\n", received, N);
+      goto fail;
+    }
 
-  printf("Resultados recibidos del servidor UDP: %zd bytes\n", r);
+    // El id y la cantidad primero: la respuesta de otro test no toca bw_result
+    uint32_t id;
+    int n_conn;
+    if (peekResult(buf, r, format, &id, &n_conn) < 0 || id != expected_id)
+      continue; // respuesta de otro test, o basura
+    if (n_conn < 1 || n_conn > N)
+    {
+      fprintf(stderr, "client: result for %d connections, expected up to %d; ignored\n", n_conn, N);
+      continue;
+    }
+    streams = n_conn;
 
-  // Deserializar y mostrar
-  if (unpackResultPayload(bw_result, buf, r) < 0)
-  {
-    fprintf(stderr, "Error unpacking result payload\n");
-    close(udp_sock);
-    return -1;
+    int first = 0, kind = RESULT_KIND_COUNTERS, n;
+    if (format == RESULT_FMT_TEXT)
+      n = unpack_text_result(bw_result, buf, r, n_conn);
+    else
+      n = unpackResultBinary(bw_result, buf, r, &first, &kind);
+    if (n < 0)
+    {
+      fprintf(stderr, "Error unpacking result payload (%d); ignored\n", n);
+      continue;
+    }
+    datagrams++;
+    if (kind == RESULT_KIND_SERIES)
+    {
+      series_received++; // duplicados no llegan: el servidor manda cada serie una vez
+      continue;
+    }
+    if (kind == RESULT_KIND_TCP)
+    {
+      tcp_received = 1;
+      continue;
+    }
+    if (got_chunk[first / RESULT_CHUNK_CONNS])
+      continue; // duplicada
+    got_chunk[first / RESULT_CHUNK_CONNS] = 1;
+    received += n;
+    if (format != RESULT_FMT_TEXT && buf[0] >= RESULT_FMT_BIN_V3 && !series_expected)
+    {
+      // Tras los contadores las series llegan enseguida: no esperar de más
+      series_expected = 1;
+      tcp_expected = buf[0] >= RESULT_FMT_BIN_V4;
+      struct timeval tail = {.tv_sec = 0, .tv_usec = RESULTS_SERIES_WAIT_MS * 1000};
+      setsockopt(udp_sock, SOL_SOCKET, SO_RCVTIMEO, &tail, sizeof(tail));
+    }
   }
 
+  printf("Resultados recibidos del servidor UDP: %d datagrama(s) (%s)\n", datagrams,
+         format == RESULT_FMT_TEXT ? "texto" : "binario");
+  if (streams < N)
+    fprintf(stderr, "client: the server saw %d of %d upload connections; the rest count as zero\n", streams, N);
+
   printf("Measurement ID: 0x%02X%02X%02X%02X\n",
          (*bw_result).id_measurement >> 24,
          ((*bw_result).id_measurement >> 16) & 0xFF,
@@ -343,13 +604,94 @@ int client_upload(const char *srv_ip, int N, struct BW_result *bw_result)
   uint64_t total_bytes = 0;
   for (int i = 0; i < N; i++)
   {
-    printf("Conn %d: bytes=%llu, duration=%.3f s\n",
-           i + 1, (unsigned long long)(*bw_result).conn_bytes[i], (*bw_result).conn_duration[i]);
+    if (verbose)
+      printf("Conn %d: bytes=%llu, duration=%.3f s\n",
+             i + 1, (unsigned long long)(*bw_result).conn_bytes[i], (*bw_result).conn_duration[i]);
     total_bytes += (*bw_result).conn_bytes[i];
   }
 
   printf("Total upload bytes: %llu\n", (unsigned long long)total_bytes);
 
   close(udp_sock);
-  return total_bytes; // Return total bytes sent for upload throughput calculation
+  return 0; // Los bytes por conexión quedan en bw_result (no caben en un int)
+
+fail:
+  freeBwResult(bw_result);
+  close(udp_sock);
+  return -1;
+}
+
+// Streams de la rampa: un test propio que nunca pide resultados (el reaper
+// del servidor lo descarta tras su TTL)
+typedef struct upload_ramp
+{
+  struct sockaddr_in srv;
+  uint8_t test_id[4];
+  int send_mode;
+  int stop;
+  cli_thread_arg_t *args; // max + 1, sockfd = -1 tras el último lanzado
+  pthread_t *threads;
+} upload_ramp_t;
+
+static int upload_ramp_start(void *ctx, int i)
+{
+  upload_ramp_t *r = ctx;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&r->srv, sizeof(r->srv)) < 0)
+  {
+    perror("upload ramp connect");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  cli_thread_arg_t *a = &r->args[i];
+  a->sockfd = fd;
+  a->send_mode = r->send_mode;
+  a->stop = &r->stop;
+  fill_header(a->header, r->test_id, i);
+  if (pthread_create(&r->threads[i], NULL, upload_client_thread, a) != 0)
+  {
+    perror("pthread_create (upload ramp)");
+    close(fd);
+    a->sockfd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+static int upload_ramp_sample(void *ctx, uint64_t *bytes)
+{
+  upload_ramp_t *r = ctx;
+  return upload_sample(r->args, bytes);
+}
+
+int upload_ramp(const char *srv_ip, int max_streams, int send_mode, double threshold, ramp_result_t *out)
+{
+  upload_ramp_t r = {.srv = {.sin_family = AF_INET, .sin_port = htons(TCP_PORT_UPLOAD)}, .send_mode = send_mode};
+  inet_pton(AF_INET, srv_ip, &r.srv.sin_addr);
+  new_test_id(r.test_id);
+  r.args = calloc(max_streams + 1, sizeof *r.args);
+  r.threads = calloc(max_streams, sizeof *r.threads);
+  if (!r.args || !r.threads)
+  {
+    perror("calloc (upload ramp)");
+    free(r.args);
+    free(r.threads);
+    return -1;
+  }
+  for (int i = 0; i <= max_streams; i++)
+    r.args[i].sockfd = -1;
+
+  printf("client: ramping upload streams to %s:%d, up to %d...\n", srv_ip, TCP_PORT_UPLOAD, max_streams);
+  int chosen = ramp_run(max_streams, threshold, upload_ramp_start, upload_ramp_sample, &r, out);
+
+  __atomic_store_n(&r.stop, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < max_streams && r.args[i].sockfd >= 0; i++)
+  {
+    pthread_join(r.threads[i], NULL);
+    close(r.args[i].sockfd);
+  }
+  free(r.args);
+  free(r.threads);
+  return chosen;
 }
@@ -4,41 +4,96 @@
 #include <stdint.h>
 #include "common.h"
 #include "handle_result.h"
+#include "worker_pool.h"
+#include "zerocopy.h"
+#include "results_table.h"
+#include "tcpinfo.h"
+#include "ramp.h"
 
 #define TCP_PORT_UPLOAD 20252
 #define UDP_PORT_RESULTS 20251
 #define MAX_PAYLOAD (8 * 1024)
+#define UPLOAD_HEADER_LEN 6 // test_id (4) + conn_id (2)
+#define RESULTS_TIMEOUT_S 2 // espera de la respuesta UDP con los resultados
+#define RESULTS_SERIES_WAIT_MS 300 // espera de las series pendientes, entre datagramas
+
+// Byte que el servidor responde al header antes de recibir datos
+#define UPLOAD_STATUS_OK 0
+#define UPLOAD_STATUS_FULL 1       // tabla de resultados llena: reintentar más tarde
+#define UPLOAD_STATUS_BAD_HEADER 2 // conn_id fuera de 1..MAX_CONN
+#define UPLOAD_STATUS_REPORTED 3   // el test ya entregó sus resultados: la conexión llega tarde
 
 // Parámetros para cada hilo del cliente de subida
 typedef struct
 {
     int sockfd;        // Socket ya conectado
-    size_t buf_size;   // Tamaño del buffer de envío
+    int send_mode;     // Cómo se envía el payload compartido (ZC_MODE_*)
     uint8_t header[6]; // Encabezado de 6 bytes (test_id + conn_id)
+    int status;        // UPLOAD_STATUS_* respondido por el servidor, -1 si no llegó
+    tcp_summary_t tcp; // Muestras de TCP_INFO mientras envía
+    uint64_t bytes;    // Enviados hasta ahora, se lee mientras corre
+    int done;          // El hilo terminó
+    const int *stop;   // Si no es NULL y se pone en 1, deja de enviar antes del cierre del servidor
 } cli_thread_arg_t;
 
 // Parámetros para cada hilo del servidor de subida
 typedef struct
 {
-    int conn_fd;               // Descriptor del socket de escucha
-    uint64_t *bytes_recv;      // Total de bytes leídos
-    double *duration;          // Segundos efectivos de lectura
-    struct timespec start;     // Tiempo de inicio de la conexión
-    int T;                     // Tiempo total de la conexión en segundos
-    results_lock_t *res_mutex; // Mutex para proteger el acceso a los resultados
+    int conn_fd;              // Descriptor del socket de escucha
+    conn_counter_t *counter;  // Bytes leídos y segundos efectivos, sin mutex
+    rt_entry_t *entry;        // Test al que pertenece el contador
+    results_table_t *results; // Tabla donde se libera entry al terminar
+    struct timespec start;    // Inicio de la conexión: cuando un worker la toma
+    int T;                    // Tiempo total de la conexión en segundos
+    int recv_mode;            // Cómo se descartan los datos recibidos (DISCARD_*)
 } srv_thread_arg_t;
 
 // Atiende una conexión TCP de subida en el servidor
 void *upload_server_thread(void *arg);
 
-// Inicia el servidor de subida TCP, lanza N hilos y envía resultados por UDP
-int server_upload(int N, int T, results_lock_t *results_lock);
+// Asigna el test de la conexión descrita por el header (test_id + conn_id)
+// y devuelve su contador, que ya incluye los 6 bytes del header. Quien atiende
+// la conexión fd es su único escritor y llama a rt_release() antes de cerrarla.
+// Devuelve el UPLOAD_STATUS_* a responder al cliente.
+int upload_claim_slot(results_table_t *results, const uint8_t header[UPLOAD_HEADER_LEN], int fd,
+                      rt_entry_t **entry, conn_counter_t **counter);
+
+// Responde el estado al header sin bloquear (el buffer de envío está vacío)
+int upload_send_status(int fd, uint8_t status);
+
+// Inicia el servidor de subida TCP; cada conexión se atiende en el pool de
+// workers (su contexto srv_thread_arg_t sale del pool, ctx_size >= su tamaño)
+int server_upload(int N, int T, results_table_t *results, worker_pool_t *pool, int recv_mode);
 
 // Envía datos al servidor en el cliente de subida
 void *upload_client_thread(void *arg);
 
-// Inicia el cliente de subida TCP, lanza N hilos y recibe resultados UDP
-// Retorna el número total de bytes enviados
-int client_upload(const char *srv_ip, int N, struct BW_result *bw_result);
+// Genera un test_id aleatorio; 0xFF al inicio es un eco de latencia
+void new_test_id(uint8_t test_id[4]);
+
+// Header del stream 0..N-1 de un test: test_id + conn_id (1..N) en orden de red.
+// Las descargas mandan el mismo (DOWNLOAD_HEADER_LEN)
+void fill_header(uint8_t header[UPLOAD_HEADER_LEN], const uint8_t test_id[4], int stream);
+
+// Inicia el cliente de subida TCP del test test_id, lanza N hilos (1..MAX_CONN) y
+// recibe resultados UDP en bw_result, que se reserva aquí (liberar con freeBwResult).
+// bw_result->download_tcp trae el resumen TCP_INFO del servidor de las descargas
+// que mandaron el mismo test_id (ceros si no hubo o el servidor es anterior).
+// Los hilos envían el payload compartido de zc_init() según send_mode.
+// Si una conexión falla, el test sigue con las anteriores: bw_result->n_conn
+// dice cuántas se usaron. Si tcp no es NULL recibe el resumen de TCP_INFO de
+// cada conexión (N; vacío en las que no se usaron).
+// Con adapt_tol > 0 la subida termina cuando la tasa total converge dentro de
+// esa cota relativa (adaptive.h), o a los T_SECONDS del servidor.
+// verbose imprime cada stream (socket, header y bytes).
+// Retorna 0, o -1 si no conectó ninguna, el servidor rechazó el test o no
+// respondió los resultados
+int client_upload(const char *srv_ip, const uint8_t test_id[4], int N, struct BW_result *bw_result, int send_mode,
+                  tcp_summary_t *tcp, double adapt_tol, int verbose);
+
+// Busca cuántos streams de subida saturan el camino (ramp.h): los agrega de a
+// poco con un test propio y los corta al terminar. Retorna la cantidad elegida,
+// o -1 si no pudo empezar
+int upload_ramp(const char *srv_ip, int max_streams, int send_mode, double threshold, ramp_result_t *out);
 
 #endif // UPLOAD_H
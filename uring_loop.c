@@ -0,0 +1,936 @@
+#define _GNU_SOURCE
+
+#include "uring_loop.h"
+#include "config.h"
+#include "upload.h"
+#include "download.h"
+#include "payload.h"
+#include <stdio.h>
+
+#ifdef HAVE_IO_URING
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define UR_ENTRIES 1024   // submission queue size
+#define UR_MAX_CONNS 4096 // connections (and fixed file slots) per loop, at most RLIMIT_NOFILE
+#define UR_SEND_DEPTH 4   // linked writes queued per download connection
+#define UR_BUF_COUNT 256  // provided receive buffers per loop (power of two)
+#define UR_BUF_GROUP 0
+#define UR_TICK_NS 100000000LL // deadline check period
+
+// Kernel 6.12+: a ring shares another's registered buffers, pinned and
+// charged to RLIMIT_MEMLOCK once. Layout of 6.13, whose nr = 0 means all;
+// 6.12 reads only src_fd and flags and wants the rest zero
+#define UR_REGISTER_CLONE_BUFFERS 30
+typedef struct ur_clone_buffers
+{
+    uint32_t src_fd;
+    uint32_t flags;
+    uint32_t src_off, dst_off, nr;
+    uint32_t pad[3];
+} ur_clone_buffers_t;
+
+// user_data: operation type in the high 32 bits, connection slot in the low 32
+#define UD(type, slot) (((uint64_t)(type) << 32) | (uint32_t)(slot))
+#define UD_TYPE(ud) ((int)((ud) >> 32))
+#define UD_SLOT(ud) ((int)((ud) & 0xffffffffu))
+
+enum ur_op
+{
+    UR_ACCEPT_DOWN,
+    UR_ACCEPT_UP,
+    UR_TICK,
+    UR_SEND,
+    UR_RECV
+};
+
+enum ur_state
+{
+    UR_FREE,
+    UR_DOWNLOAD,
+    UR_UPLOAD_HEADER,
+    UR_UPLOAD_DATA
+};
+
+typedef struct ur_conn
+{
+    enum ur_state state;
+    int fd;       // regular descriptor, for shutdown()/close()
+    int inflight; // submitted requests not yet completed
+    int closing;  // shutdown() issued, release once inflight reaches 0
+    struct timespec start;
+    struct timespec deadline;
+    uint8_t header[6];
+    size_t header_len;
+    rt_entry_t *entry;       // upload: test in the results table, released with the conn
+    conn_counter_t *counter; // upload: this connection's counter in entry
+    uint64_t bytes;          // upload: running total, published to counter
+    tcp_summary_t tcp;       // TCP_INFO, sampled every tick and logged on release
+    size_t payload_off;      // download: offset of the next write in the payload
+    int prev, next; // deadline list, by slot (-1 terminated)
+} ur_conn_t;
+
+typedef struct uring
+{
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask;
+    unsigned sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqes_sz;
+} uring_t;
+
+typedef struct uring_loop
+{
+    int id;
+    const event_loop_cfg_t *cfg;
+    int down_fd, up_fd; // this loop's listeners
+    uring_t ring;
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    uint8_t *bufs;
+    ur_conn_t *conns;
+    int max_conns; // UR_MAX_CONNS clamped to RLIMIT_NOFILE
+    int *free_slots;
+    int n_free;
+    int head, tail; // deadline list (FIFO: every connection lives T seconds)
+    struct __kernel_timespec tick;
+    int tick_armed;
+    int accept_armed[2];  // indexed by UR_ACCEPT_DOWN / UR_ACCEPT_UP
+    int accept_paused[2]; // accept failed: re-armed from the next tick
+    int accept_multishot; // kernel 5.19+, else one accept per request
+    int recv_multishot;   // kernel 6.0+, else one recv per request
+    int payload_fixed;    // WRITE_FIXED from the registered payload, else plain SENDs
+    pthread_t thr;
+} uring_loop_t;
+
+// Holds the payload's registration for every loop to clone; -1 if the
+// kernel cannot clone, and each loop registers (and is charged for) its own
+static int payload_ring = -1;
+static int payload_unpinned; // it did not fit RLIMIT_MEMLOCK: loops send it unregistered
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void ring_exit(uring_t *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_sz);
+    if (r->fd >= 0)
+        close(r->fd);
+}
+
+static int ring_init(uring_t *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(r, 0, sizeof *r);
+    memset(&p, 0, sizeof p);
+    // Multishot requests post many completions per submission: size the CQ for it
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 8;
+
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0 && errno == EINVAL)
+    {
+        memset(&p, 0, sizeof p);
+        r->fd = sys_io_uring_setup(entries, &p);
+    }
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_sz > r->sq_sz)
+            r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+    {
+        r->sq_ptr = NULL;
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else
+    {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+        {
+            r->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes = NULL;
+        goto fail;
+    }
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+
+    // Identity mapping: SQE i always sits at index i of the array
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    return 0;
+
+fail:
+    ring_exit(r);
+    return -1;
+}
+
+static int ring_submit(uring_t *r, unsigned wait_nr)
+{
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned pending = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (pending == 0 && wait_nr == 0)
+        return 0;
+    int ret = sys_io_uring_enter(r->fd, pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0 && errno != EINTR && errno != EBUSY)
+        return -1;
+    return 0;
+}
+
+static unsigned ring_space(uring_t *r)
+{
+    return r->sq_entries - (r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+// Returns NULL when the kernel cannot take more work right now; callers
+// leave the request unqueued and on_tick() retries it.
+static struct io_uring_sqe *ring_get_sqe(uring_t *r, unsigned needed)
+{
+    if (ring_space(r) < needed)
+    {
+        // Queue full: hand what we have to the kernel first
+        if (ring_submit(r, 0) < 0 || ring_space(r) < needed)
+            return NULL;
+    }
+    struct io_uring_sqe *sqe = &r->sqes[r->sq_local_tail & *r->sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+    r->sq_local_tail++;
+    return sqe;
+}
+
+static void buf_ring_add(uring_loop_t *loop, unsigned short bid, unsigned offset)
+{
+    struct io_uring_buf_ring *br = loop->br;
+    unsigned short tail = br->tail;
+    struct io_uring_buf *buf = &br->bufs[(tail + offset) & (UR_BUF_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(loop->bufs + (size_t)bid * MAX_PAYLOAD);
+    buf->len = MAX_PAYLOAD;
+    buf->bid = bid;
+}
+
+static void buf_ring_advance(uring_loop_t *loop, unsigned short count)
+{
+    __atomic_store_n(&loop->br->tail, (unsigned short)(loop->br->tail + count), __ATOMIC_RELEASE);
+}
+
+// The kernel refuses tables larger than RLIMIT_NOFILE (EMFILE): each slot
+// holds an accepted socket, which needs a descriptor of its own anyway
+static int max_conns_for_rlimit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < UR_MAX_CONNS)
+        return (int)rl.rlim_cur;
+    return UR_MAX_CONNS;
+}
+
+static int files_register(uring_loop_t *loop)
+{
+    // Kernels 5.19+ take an empty table directly; older ones want an array of -1
+    struct io_uring_rsrc_register rr = {.nr = (unsigned)loop->max_conns, .flags = IORING_RSRC_REGISTER_SPARSE};
+    if (sys_io_uring_register(loop->ring.fd, IORING_REGISTER_FILES2, &rr, sizeof rr) == 0)
+        return 0;
+
+    int *fds = malloc(loop->max_conns * sizeof *fds);
+    if (!fds)
+    {
+        perror("io_uring: malloc (fixed files)");
+        return -1;
+    }
+    for (int i = 0; i < loop->max_conns; i++)
+        fds[i] = -1;
+    int ret = sys_io_uring_register(loop->ring.fd, IORING_REGISTER_FILES, fds, loop->max_conns);
+    free(fds);
+    if (ret < 0)
+    {
+        fprintf(stderr, "io_uring: registering %d fixed files: %s\n", loop->max_conns, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// ENOMEM from a buffer registration: without CAP_IPC_LOCK the pinned pages
+// count against RLIMIT_MEMLOCK. Returns 1 if that limit explains it
+static int payload_over_memlock(void)
+{
+    struct rlimit rl;
+    if (errno != ENOMEM || getrlimit(RLIMIT_MEMLOCK, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY)
+        return 0;
+    if (!__atomic_exchange_n(&payload_unpinned, 1, __ATOMIC_RELAXED))
+        fprintf(stderr, "io_uring: the %zu KB payload does not fit RLIMIT_MEMLOCK (%llu KB): downloads send it "
+                        "unregistered; raise ulimit -l to register it\n",
+                payload_len() / 1024, (unsigned long long)rl.rlim_cur / 1024);
+    return 1;
+}
+
+// Registers the payload once, on a ring of its own, before any loop starts
+static void payload_ring_open(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    int fd = sys_io_uring_setup(1, &p);
+    if (fd < 0)
+        return; // the probe loop reports why
+
+    // Cloning from a ring with no buffers fails with ENXIO only where cloning exists
+    memset(&p, 0, sizeof p);
+    int probe = sys_io_uring_setup(1, &p);
+    ur_clone_buffers_t cb = {.src_fd = (uint32_t)fd};
+    int can_clone = probe >= 0 && sys_io_uring_register(probe, UR_REGISTER_CLONE_BUFFERS, &cb, 1) < 0 &&
+                    errno == ENXIO;
+    if (probe >= 0)
+        close(probe);
+
+    // The shared payload (payload.h), mapped writable for this
+    struct iovec iov = {.iov_base = (void *)payload_data(), .iov_len = payload_len()};
+    if (!can_clone || sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+    {
+        if (can_clone && !payload_over_memlock())
+            perror("io_uring: registering the payload buffer");
+        close(fd);
+        return;
+    }
+    payload_ring = fd;
+}
+
+static int payload_register(uring_loop_t *loop)
+{
+    loop->payload_fixed = 0;
+    if (__atomic_load_n(&payload_unpinned, __ATOMIC_RELAXED))
+        return 0;
+    if (payload_ring >= 0)
+    {
+        ur_clone_buffers_t cb = {.src_fd = (uint32_t)payload_ring};
+        if (sys_io_uring_register(loop->ring.fd, UR_REGISTER_CLONE_BUFFERS, &cb, 1) < 0)
+        {
+            perror("io_uring: cloning the payload buffer");
+            return -1;
+        }
+        loop->payload_fixed = 1;
+        return 0;
+    }
+
+    // Older kernels: pinned once per loop
+    struct iovec iov = {.iov_base = (void *)payload_data(), .iov_len = payload_len()};
+    if (sys_io_uring_register(loop->ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+    {
+        if (payload_over_memlock())
+            return 0;
+        perror("io_uring: registering the payload buffer");
+        return -1;
+    }
+    loop->payload_fixed = 1;
+    return 0;
+}
+
+static int setup_buffers(uring_loop_t *loop)
+{
+    if (payload_register(loop) < 0)
+        return -1;
+
+    // Sparse fixed-file table: slots are filled as connections are accepted
+    if (files_register(loop) < 0)
+        return -1;
+
+    loop->br_sz = UR_BUF_COUNT * sizeof(struct io_uring_buf);
+    loop->br = mmap(NULL, loop->br_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (loop->br == MAP_FAILED)
+    {
+        perror("io_uring: mmap (buffer ring)");
+        loop->br = NULL;
+        return -1;
+    }
+    loop->bufs = malloc((size_t)UR_BUF_COUNT * MAX_PAYLOAD);
+    if (!loop->bufs)
+    {
+        perror("io_uring: malloc (receive buffers)");
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)loop->br,
+        .ring_entries = UR_BUF_COUNT,
+        .bgid = UR_BUF_GROUP};
+    if (sys_io_uring_register(loop->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        perror("io_uring: registering the provided-buffer ring (kernel 5.19+)");
+        return -1;
+    }
+
+    loop->br->tail = 0;
+    for (unsigned short i = 0; i < UR_BUF_COUNT; i++)
+        buf_ring_add(loop, i, i);
+    buf_ring_advance(loop, UR_BUF_COUNT);
+    return 0;
+}
+
+static int files_update(uring_loop_t *loop, int slot, int fd)
+{
+    struct io_uring_files_update up = {.offset = (unsigned)slot, .fds = (uint64_t)(uintptr_t)&fd};
+    return sys_io_uring_register(loop->ring.fd, IORING_REGISTER_FILES_UPDATE, &up, 1);
+}
+
+static void queue_accept(uring_loop_t *loop, int listen_fd, int op)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, 1);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = loop->accept_multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = UD(op, 0);
+    loop->accept_armed[op] = 1;
+}
+
+static void queue_tick(uring_loop_t *loop)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, 1);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->tick;
+    sqe->len = 1;
+    sqe->user_data = UD(UR_TICK, 0);
+    loop->tick_armed = 1;
+}
+
+// Queues UR_SEND_DEPTH linked writes so they hit the socket in order
+static void queue_sends(uring_loop_t *loop, int slot)
+{
+    ur_conn_t *c = &loop->conns[slot];
+    for (int i = 0; i < UR_SEND_DEPTH; i++)
+    {
+        // Room for the rest of the chain, so a link never dangles into another request
+        struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, i == 0 ? UR_SEND_DEPTH : 1);
+        if (!sqe)
+            return;
+        sqe->opcode = loop->payload_fixed ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+        sqe->fd = slot;
+        sqe->flags = IOSQE_FIXED_FILE | (i < UR_SEND_DEPTH - 1 ? IOSQE_IO_LINK : 0);
+        // A random payload is walked, so the wire does not repeat; short writes just skip bytes
+        sqe->addr = (uint64_t)(uintptr_t)(payload_data() + c->payload_off);
+        sqe->len = (uint32_t)payload_send_size();
+        c->payload_off = payload_advance(c->payload_off, payload_send_size());
+        if (loop->payload_fixed)
+            sqe->buf_index = 0;
+        else
+            sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = UD(UR_SEND, slot);
+        c->inflight++;
+    }
+}
+
+static void queue_recv(uring_loop_t *loop, int slot)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, 1);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = slot;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = loop->recv_multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->buf_group = UR_BUF_GROUP;
+    sqe->user_data = UD(UR_RECV, slot);
+    loop->conns[slot].inflight++;
+}
+
+static void list_unlink(uring_loop_t *loop, int slot)
+{
+    ur_conn_t *c = &loop->conns[slot];
+    if (c->prev >= 0)
+        loop->conns[c->prev].next = c->next;
+    else if (loop->head == slot)
+        loop->head = c->next;
+    if (c->next >= 0)
+        loop->conns[c->next].prev = c->prev;
+    else if (loop->tail == slot)
+        loop->tail = c->prev;
+    c->prev = c->next = -1;
+}
+
+static void conn_release(uring_loop_t *loop, int slot);
+
+// Stops the connection: pending requests fail and the slot is released when
+// they drain, or right away if none is in flight (no completion would do it)
+static void conn_shutdown(uring_loop_t *loop, int slot)
+{
+    ur_conn_t *c = &loop->conns[slot];
+    if (!c->closing)
+    {
+        c->closing = 1;
+        list_unlink(loop, slot);
+        shutdown(c->fd, SHUT_RDWR);
+        if (c->inflight == 0)
+            conn_release(loop, slot);
+    }
+}
+
+static void conn_release(uring_loop_t *loop, int slot)
+{
+    ur_conn_t *c = &loop->conns[slot];
+    char what[64];
+    tcpi_sample(c->fd, &c->tcp);
+    snprintf(what, sizeof what, "server: %s TCP (fd: %d)", c->state == UR_DOWNLOAD ? "download" : "upload", c->fd);
+    tcpi_print(&c->tcp, what);
+    if (c->state == UR_DOWNLOAD)
+    {
+        printf("server: finished sending data to client (fd: %d)\n", c->fd);
+        server_download_report(loop->cfg->results, c->fd, &c->tcp);
+    }
+    else
+    {
+        // The uploader may be stuck on a zero window after we stopped reading:
+        // reset the connection so its send() fails instead of waiting on FIN-WAIT-2
+        struct linger lg = {.l_onoff = 1, .l_linger = 0};
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof lg);
+        if (c->entry)
+            rt_release(loop->cfg->results, c->entry, c->counter);
+    }
+    list_unlink(loop, slot);
+    files_update(loop, slot, -1);
+    close(c->fd);
+    c->state = UR_FREE;
+    c->closing = 0;
+    loop->free_slots[loop->n_free++] = slot;
+}
+
+static void on_accept(uring_loop_t *loop, int op, int fd)
+{
+    if (loop->n_free == 0 || files_update(loop, loop->free_slots[loop->n_free - 1], fd) < 0)
+    {
+        fprintf(stderr, "uring loop %d: cannot register connection, dropping it\n", loop->id);
+        close(fd);
+        return;
+    }
+    int slot = loop->free_slots[--loop->n_free];
+    ur_conn_t *c = &loop->conns[slot];
+    memset(c, 0, sizeof *c);
+    c->fd = fd;
+    c->start = now_ts();
+    c->deadline = c->start;
+    c->deadline.tv_sec += loop->cfg->T;
+
+    c->prev = loop->tail;
+    c->next = -1;
+    if (loop->tail >= 0)
+        loop->conns[loop->tail].next = slot;
+    else
+        loop->head = slot;
+    loop->tail = slot;
+
+    if (op == UR_ACCEPT_DOWN)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t len = sizeof client_addr;
+        char ip[INET_ADDRSTRLEN] = "?";
+        if (getpeername(fd, (struct sockaddr *)&client_addr, &len) == 0)
+            inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof ip);
+        printf("server: download connection from %s (ring %d)\n", ip, loop->id);
+        c->state = UR_DOWNLOAD;
+        queue_sends(loop, slot);
+    }
+    else
+    {
+        c->state = UR_UPLOAD_HEADER;
+        queue_recv(loop, slot);
+    }
+}
+
+static void on_recv(uring_loop_t *loop, ur_conn_t *c, int slot, int res, unsigned flags)
+{
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER))
+    {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t *data = loop->bufs + (size_t)bid * MAX_PAYLOAD;
+        size_t len = (size_t)res;
+
+        if (c->state == UR_UPLOAD_HEADER)
+        {
+            size_t need = sizeof c->header - c->header_len;
+            size_t take = len < need ? len : need;
+            memcpy(c->header + c->header_len, data, take);
+            c->header_len += take;
+            len -= take;
+            if (c->header_len == sizeof c->header)
+            {
+                uint8_t status = upload_claim_slot(loop->cfg->results, c->header, c->fd, &c->entry, &c->counter);
+                upload_send_status(c->fd, status);
+                if (status != UPLOAD_STATUS_OK)
+                    conn_shutdown(loop, slot);
+                else
+                {
+                    c->state = UR_UPLOAD_DATA;
+                    c->bytes = UPLOAD_HEADER_LEN;
+                }
+            }
+        }
+
+        if (c->state == UR_UPLOAD_DATA && len > 0)
+        {
+            struct timespec now = now_ts();
+            c->bytes += len;
+            conn_counter_publish(c->counter, c->bytes, diff_ts(&c->start, &now));
+        }
+
+        // Give the buffer back to the kernel
+        buf_ring_add(loop, bid, 0);
+        buf_ring_advance(loop, 1);
+    }
+    else if (res == -EINVAL && loop->recv_multishot)
+    {
+        // The probe guessed wrong: this kernel has no multishot recv
+        fprintf(stderr, "uring loop %d: multishot recv unsupported, one recv per request\n", loop->id);
+        loop->recv_multishot = 0;
+    }
+    else if (res == 0 || (res < 0 && res != -ENOBUFS))
+    {
+        conn_shutdown(loop, slot);
+    }
+
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+        // Multishot ended (EOF, error or out of buffers): re-arm unless stopping
+        c->inflight--;
+        if (!c->closing)
+            queue_recv(loop, slot);
+    }
+}
+
+static void on_tick(uring_loop_t *loop)
+{
+    struct timespec now = now_ts();
+    loop->tick_armed = 0;
+    loop->accept_paused[UR_ACCEPT_DOWN] = loop->accept_paused[UR_ACCEPT_UP] = 0;
+    while (loop->head >= 0)
+    {
+        ur_conn_t *c = &loop->conns[loop->head];
+        if (diff_ts(&now, &c->deadline) > 0)
+            break;
+        conn_shutdown(loop, loop->head);
+    }
+
+    // Requests that found the submission queue full are retried here
+    for (int slot = loop->head; slot >= 0; slot = loop->conns[slot].next)
+    {
+        ur_conn_t *c = &loop->conns[slot];
+        tcpi_poll(c->fd, &c->tcp, diff_ts(&c->start, &now));
+        if (c->inflight > 0)
+            continue;
+        if (c->state == UR_DOWNLOAD)
+            queue_sends(loop, slot);
+        else
+            queue_recv(loop, slot);
+    }
+}
+
+static void loop_destroy(uring_loop_t *loop)
+{
+    ring_exit(&loop->ring);
+    if (loop->br)
+        munmap(loop->br, loop->br_sz);
+    free(loop->bufs);
+    free(loop->conns);
+    free(loop->free_slots);
+}
+
+// Opcodes every loop needs, and what multishot support can be told from:
+// the probe lists opcodes, not flags, so each multishot flag is assumed from
+// an opcode of the same kernel release (and dropped at run time on EINVAL)
+static int probe_ops(uring_loop_t *loop)
+{
+    static const int required[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_WRITE_FIXED, IORING_OP_TIMEOUT};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe)
+        return -1;
+    if (sys_io_uring_register(loop->ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    {
+        perror("io_uring: probing opcodes (kernel 5.6+)");
+        free(probe);
+        return URING_UNAVAILABLE;
+    }
+#define OP_SUPPORTED(op) ((op) <= probe->last_op && (probe->ops[(op)].flags & IO_URING_OP_SUPPORTED))
+    int rc = 0;
+    for (size_t i = 0; i < sizeof required / sizeof required[0]; i++)
+    {
+        if (!OP_SUPPORTED(required[i]))
+        {
+            fprintf(stderr, "io_uring: opcode %d unsupported by this kernel\n", required[i]);
+            rc = URING_UNAVAILABLE;
+        }
+    }
+    loop->accept_multishot = OP_SUPPORTED(IORING_OP_SOCKET); // 5.19
+    loop->recv_multishot = OP_SUPPORTED(IORING_OP_SEND_ZC);  // 6.0
+#undef OP_SUPPORTED
+    free(probe);
+    return rc;
+}
+
+static int loop_init(uring_loop_t *loop)
+{
+    loop->head = loop->tail = -1;
+    loop->tick.tv_nsec = UR_TICK_NS;
+
+    if (ring_init(&loop->ring, UR_ENTRIES) < 0)
+    {
+        // No io_uring at all (old kernel, disabled by sysctl or seccomp): epoll can take over
+        int unavailable = errno == ENOSYS || errno == EPERM;
+        perror("io_uring_setup");
+        loop->ring.fd = -1;
+        return unavailable ? URING_UNAVAILABLE : -1;
+    }
+    int rc = probe_ops(loop);
+    if (rc < 0)
+    {
+        loop_destroy(loop);
+        return rc;
+    }
+    loop->max_conns = max_conns_for_rlimit();
+    loop->conns = calloc(loop->max_conns, sizeof *loop->conns);
+    loop->free_slots = malloc(loop->max_conns * sizeof *loop->free_slots);
+    if (!loop->conns || !loop->free_slots || setup_buffers(loop) < 0)
+    {
+        loop_destroy(loop);
+        return -1;
+    }
+    for (int i = 0; i < loop->max_conns; i++)
+        loop->free_slots[loop->n_free++] = loop->max_conns - 1 - i;
+
+    return 0;
+}
+
+static void *uring_thread(void *arg)
+{
+    uring_loop_t *loop = arg;
+    uring_t *r = &loop->ring;
+
+    // Rings, buffers and connection slots are allocated by the (possibly pinned)
+    // loop thread itself, so first-touch places them on its NUMA node
+    if (loop_init(loop) < 0)
+    {
+        fprintf(stderr, "uring loop %d: io_uring setup failed\n", loop->id);
+        return NULL;
+    }
+
+    while (1)
+    {
+        if (!loop->tick_armed)
+            queue_tick(loop);
+        for (int op = UR_ACCEPT_DOWN; op <= UR_ACCEPT_UP; op++)
+            if (!loop->accept_armed[op] && !loop->accept_paused[op])
+                queue_accept(loop, op == UR_ACCEPT_DOWN ? loop->down_fd : loop->up_fd, op);
+
+        if (ring_submit(r, 1) < 0)
+        {
+            perror("io_uring_enter");
+            break;
+        }
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            int op = UD_TYPE(cqe->user_data);
+            int slot = UD_SLOT(cqe->user_data);
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            ur_conn_t *c = &loop->conns[slot];
+
+            // Free the CQE before handling it, so submissions made from the handlers
+            // never find the completion queue full
+            __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+
+            switch (op)
+            {
+            case UR_ACCEPT_DOWN:
+            case UR_ACCEPT_UP:
+                if (res >= 0)
+                    on_accept(loop, op, res);
+                else if (res == -EINVAL && loop->accept_multishot)
+                {
+                    fprintf(stderr, "uring loop %d: multishot accept unsupported, one accept per request\n", loop->id);
+                    loop->accept_multishot = 0;
+                }
+                else
+                {
+                    // EMFILE, ENFILE, ENOMEM... persist: retry from the tick, not in a hot loop
+                    fprintf(stderr, "uring accept: %s\n", strerror(-res));
+                    loop->accept_paused[op] = 1;
+                }
+                if (!(flags & IORING_CQE_F_MORE))
+                    loop->accept_armed[op] = 0;
+                break;
+            case UR_TICK:
+                on_tick(loop);
+                break;
+            case UR_SEND:
+                c->inflight--;
+                // -ECANCELED: a short write earlier in the chain broke the link
+                if (res < 0 && res != -ECANCELED && !c->closing)
+                {
+                    // The client closing early to end the test is not an error
+                    if (res != -EPIPE && res != -ECONNRESET)
+                        fprintf(stderr, "uring send: %s\n", strerror(-res));
+                    conn_shutdown(loop, slot);
+                }
+                else if (c->inflight == 0 && !c->closing)
+                    queue_sends(loop, slot);
+                break;
+            case UR_RECV:
+                on_recv(loop, c, slot, res, flags);
+                break;
+            }
+
+            if ((op == UR_SEND || op == UR_RECV) && c->state != UR_FREE && c->closing && c->inflight == 0)
+                conn_release(loop, slot);
+        }
+    }
+    loop_destroy(loop);
+    return NULL;
+}
+
+int uring_loop_run(const event_loop_cfg_t *cfg)
+{
+    int n = cfg->n_loops > 0 ? cfg->n_loops : 1;
+    if (!payload_data() && payload_init(PAYLOAD, PAYLOAD_PINNABLE) < 0)
+        return URING_UNAVAILABLE;
+
+    // WRITE_FIXED has no MSG_NOSIGNAL: a client closing early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    uring_loop_t *loops = calloc(n, sizeof *loops);
+    if (!loops)
+    {
+        perror("calloc");
+        return -1;
+    }
+
+    payload_ring_open();
+
+    // Probe with a throwaway loop: nothing runs unless every feature we use works.
+    // Only a kernel without io_uring falls back to epoll; any other failure
+    // (limits, memory) is reported and ends the server, -m uring was asked for.
+    loops[0].cfg = cfg;
+    int rc = loop_init(&loops[0]);
+    if (rc < 0)
+    {
+        fprintf(stderr, "server: io_uring setup failed%s\n", rc == URING_UNAVAILABLE ? "" : ", not falling back to epoll");
+        if (payload_ring >= 0)
+            close(payload_ring);
+        free(loops);
+        return rc == URING_UNAVAILABLE ? URING_UNAVAILABLE : -1;
+    }
+    if (loops[0].max_conns < UR_MAX_CONNS)
+        printf("server: io_uring loops hold %d connections each (RLIMIT_NOFILE)\n", loops[0].max_conns);
+    loop_destroy(&loops[0]);
+
+    int started = 0;
+    for (int i = 0; i < n; i++)
+    {
+        memset(&loops[i], 0, sizeof loops[i]);
+        loops[i].id = i;
+        loops[i].cfg = cfg;
+        loops[i].down_fd = cfg->down_fds[i];
+        loops[i].up_fd = cfg->up_fds[i];
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        int cpu = cfg->sharded ? cpu_by_index(i) : -1;
+        if (cpu >= 0 && thread_attr_pin(&attr, cpu) != 0)
+            fprintf(stderr, "uring loop %d: cannot pin to CPU %d\n", i, cpu);
+
+        rc = pthread_create(&loops[i].thr, &attr, uring_thread, &loops[i]);
+        pthread_attr_destroy(&attr);
+        if (rc != 0)
+        {
+            perror("pthread_create (uring loop)");
+            break;
+        }
+        started++;
+    }
+    printf("server: %d io_uring loop(s) running%s\n", started,
+           cfg->sharded ? " (SO_REUSEPORT shards, pinned)" : "");
+
+    for (int i = 0; i < started; i++)
+        pthread_join(loops[i].thr, NULL);
+
+    if (payload_ring >= 0)
+        close(payload_ring);
+    free(loops);
+    return started == n ? 0 : -1;
+}
+
+#else /* !HAVE_IO_URING */
+
+int uring_loop_run(const event_loop_cfg_t *cfg)
+{
+    (void)cfg;
+    fprintf(stderr, "server: built without io_uring support (make URING=1)\n");
+    return URING_UNAVAILABLE;
+}
+
+#endif /* HAVE_IO_URING */
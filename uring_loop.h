@@ -0,0 +1,25 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include "event_loop.h"
+
+#define URING_UNAVAILABLE -2 // kernel or build without io_uring support
+
+/**
+ * @brief Runs the io_uring-based server core.
+ *
+ * Same contract as event_loop_run(): cfg->n_loops threads serve both
+ * listening sockets. Each thread owns a ring with the accepted sockets
+ * registered as fixed files; downloads are sent as chains of linked
+ * WRITE_FIXED requests from a registered payload buffer and uploads are
+ * drained by a multishot recv over a provided-buffer ring.
+ *
+ * @param cfg Listening sockets, duration and results table.
+ * @return int 0 once every loop has exited, URING_UNAVAILABLE if the kernel
+ *         has no io_uring (nothing was started, the caller may fall back to
+ *         epoll), -1 on other errors,
+ *         setup failures included: those are reported, not papered over.
+ */
+int uring_loop_run(const event_loop_cfg_t *cfg);
+
+#endif // URING_LOOP_H
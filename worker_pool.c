@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+
+#include "worker_pool.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_CTX_ALIGN 16
+
+struct pool_item
+{
+    pool_item_t *next;
+    pool_task_fn fn;
+    // handler context follows at POOL_CTX_OFFSET
+};
+
+#define POOL_CTX_OFFSET ((sizeof(pool_item_t) + POOL_CTX_ALIGN - 1) & ~(size_t)(POOL_CTX_ALIGN - 1))
+
+static void *item_ctx(pool_item_t *item)
+{
+    return (char *)item + POOL_CTX_OFFSET;
+}
+
+static pool_item_t *ctx_item(void *ctx)
+{
+    return (pool_item_t *)((char *)ctx - POOL_CTX_OFFSET);
+}
+
+static void *pool_worker(void *arg)
+{
+    worker_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1)
+    {
+        while (!pool->head)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+
+        pool_item_t *item = pool->head;
+        pool->head = item->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pool->stats.queued--;
+        pool->stats.busy++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        item->fn(item_ctx(item));
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->stats.busy--;
+        item->next = pool->free_list;
+        pool->free_list = item;
+    }
+    return NULL;
+}
+
+int pool_init(worker_pool_t *pool, const pool_cfg_t *cfg)
+{
+    memset(pool, 0, sizeof *pool);
+    if (cfg->n_workers < 1 || cfg->queue_len < 0)
+        return -1;
+
+    int n_items = cfg->n_workers + cfg->queue_len;
+    pool->stride = (POOL_CTX_OFFSET + cfg->ctx_size + POOL_CTX_ALIGN - 1) & ~(size_t)(POOL_CTX_ALIGN - 1);
+    pool->slab = calloc(n_items, pool->stride);
+    pool->workers = calloc(cfg->n_workers, sizeof *pool->workers);
+    if (!pool->slab || !pool->workers)
+    {
+        perror("calloc (worker pool)");
+        free(pool->slab);
+        free(pool->workers);
+        return -1;
+    }
+    for (int i = n_items - 1; i >= 0; i--)
+    {
+        pool_item_t *item = (pool_item_t *)(pool->slab + (size_t)i * pool->stride);
+        item->next = pool->free_list;
+        pool->free_list = item;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (cfg->stack_size > 0)
+    {
+        size_t stack = cfg->stack_size < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : cfg->stack_size;
+        if (pthread_attr_setstacksize(&attr, stack) != 0)
+            fprintf(stderr, "worker pool: invalid stack size %zu, using default\n", stack);
+    }
+
+    for (int i = 0; i < cfg->n_workers; i++)
+    {
+        if (pthread_create(&pool->workers[i], &attr, pool_worker, pool) != 0)
+        {
+            perror("pthread_create (worker pool)");
+            break;
+        }
+        pool->n_workers++;
+    }
+    pthread_attr_destroy(&attr);
+
+    return pool->n_workers > 0 ? 0 : -1;
+}
+
+void *pool_ctx_get(worker_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool_item_t *item = pool->free_list;
+    if (item)
+        pool->free_list = item->next;
+    else
+        pool->stats.rejected++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!item)
+        return NULL;
+    void *ctx = item_ctx(item);
+    memset(ctx, 0, pool->stride - POOL_CTX_OFFSET);
+    return ctx;
+}
+
+void pool_ctx_put(worker_pool_t *pool, void *ctx)
+{
+    pool_item_t *item = ctx_item(ctx);
+    pthread_mutex_lock(&pool->mutex);
+    item->next = pool->free_list;
+    pool->free_list = item;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_submit(worker_pool_t *pool, void *ctx, pool_task_fn fn)
+{
+    pool_item_t *item = ctx_item(ctx);
+    item->fn = fn;
+    item->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tail)
+        pool->tail->next = item;
+    else
+        pool->head = item;
+    pool->tail = item;
+    pool->stats.submitted++;
+    if (++pool->stats.queued > pool->stats.max_queued)
+        pool->stats.max_queued = pool->stats.queued;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_get_stats(worker_pool_t *pool, pool_stats_t *stats)
+{
+    pthread_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_print_stats(worker_pool_t *pool, const char *what)
+{
+    pool_stats_t st;
+    pool_get_stats(pool, &st);
+    fprintf(stderr, "%s: workers %d busy %d, queued %d (max %d), submitted %llu, rejected %llu\n",
+            what, pool->n_workers, st.busy, st.queued, st.max_queued,
+            (unsigned long long)st.submitted, (unsigned long long)st.rejected);
+}
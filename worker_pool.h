@@ -0,0 +1,69 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*pool_task_fn)(void *ctx);
+
+typedef struct pool_item pool_item_t;
+
+typedef struct pool_stats
+{
+    uint64_t submitted; // tasks accepted into the queue
+    uint64_t rejected;  // tasks refused because every context was in use
+    int queued;         // tasks waiting for a worker right now
+    int max_queued;     // high-water mark of queued
+    int busy;           // workers running a task right now
+} pool_stats_t;
+
+// Fixed set of workers fed from a bounded queue of preallocated contexts
+typedef struct worker_pool
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char *slab;               // n_items contexts, allocated once
+    size_t stride;            // bytes per item in the slab
+    pool_item_t *free_list;   // contexts not in use
+    pool_item_t *head, *tail; // queued tasks
+    int n_workers;
+    pthread_t *workers;
+    pool_stats_t stats;
+} worker_pool_t;
+
+typedef struct pool_cfg
+{
+    int n_workers;     // threads running tasks
+    int queue_len;     // tasks that may wait for a worker before new ones are rejected
+    size_t ctx_size;   // bytes of handler state per task
+    size_t stack_size; // worker stack size in bytes (0: system default)
+} pool_cfg_t;
+
+/**
+ * @brief Starts the workers and preallocates n_workers + queue_len contexts.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int pool_init(worker_pool_t *pool, const pool_cfg_t *cfg);
+
+/**
+ * @brief Takes a free handler context of cfg->ctx_size bytes.
+ *
+ * @return void* The context, or NULL (counted as a rejection) when every
+ *         context is running or queued.
+ */
+void *pool_ctx_get(worker_pool_t *pool);
+
+// Queues fn(ctx) for a worker; ctx must come from pool_ctx_get() and goes back to the free list after fn
+void pool_submit(worker_pool_t *pool, void *ctx, pool_task_fn fn);
+
+// Returns a context that will not be submitted
+void pool_ctx_put(worker_pool_t *pool, void *ctx);
+
+void pool_get_stats(worker_pool_t *pool, pool_stats_t *stats);
+
+// Prints the counters on one line, prefixed by what
+void pool_print_stats(worker_pool_t *pool, const char *what);
+
+#endif // WORKER_POOL_H
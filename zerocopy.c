@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include "zerocopy.h"
+#include "config.h" // For PAYLOAD
+#include "payload.h" // For payload_init, payload_data
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h> // For SOL_IP, IP_RECVERR, IPV6_RECVERR
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define ZC_FILE_LEN (64 * PAYLOAD) // memfd size for ZC_MODE_SENDFILE, at least 8 sends
+#define ZC_FULL_WAIT_MS 100        // wait for completions when ZC_RING are outstanding
+
+static const char *zc_payload; // the shared payload (payload.h), read-only
+static size_t zc_len;          // bytes per send
+static off_t zc_file_len;
+static int zc_memfd = -1; // ZC_MODE_SENDFILE source
+static zc_stats_t zc_totals;
+
+static const char *const zc_names[] = {"copy", "msg", "sendfile"};
+
+const char *zc_mode_name(int mode)
+{
+    return (mode >= ZC_MODE_COPY && mode <= ZC_MODE_SENDFILE) ? zc_names[mode] : "?";
+}
+
+int zc_mode_parse(const char *name)
+{
+    for (int i = ZC_MODE_COPY; i <= ZC_MODE_SENDFILE; i++)
+    {
+        if (strcmp(name, zc_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int memfd_payload_init(void)
+{
+    int fd = memfd_create("payload", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        perror("memfd_create");
+        return -1;
+    }
+    // The whole payload (a random one does not repeat), as many times as needed
+    size_t region = payload_len();
+    off_t min_len = zc_len * 8 > ZC_FILE_LEN ? (off_t)zc_len * 8 : ZC_FILE_LEN;
+    zc_file_len = (min_len + region - 1) / region * region;
+    for (off_t off = 0; off < zc_file_len; off += region)
+    {
+        if (pwrite(fd, zc_payload, region, off) != (ssize_t)region)
+        {
+            perror("pwrite (memfd payload)");
+            close(fd);
+            return -1;
+        }
+    }
+    zc_memfd = fd;
+    return 0;
+}
+
+int zc_init(int mode)
+{
+    if (zc_payload)
+        return mode == ZC_MODE_SENDFILE && zc_memfd < 0 ? ZC_MODE_COPY : mode;
+
+    // Default payload unless the program set one up with its own size
+    if (!payload_data() && payload_init(PAYLOAD, 0) < 0)
+        return -1;
+    zc_payload = payload_data();
+    zc_len = payload_send_size();
+
+    if (mode == ZC_MODE_SENDFILE)
+    {
+        if (memfd_payload_init() < 0)
+            return ZC_MODE_COPY;
+        // sendfile() has no MSG_NOSIGNAL
+        signal(SIGPIPE, SIG_IGN);
+    }
+    return mode;
+}
+
+void zc_sender_init(zc_sender_t *s, int fd, int mode)
+{
+    memset(s, 0, sizeof *s);
+    s->fd = fd;
+    s->mode = mode;
+
+    const int one = 1;
+    if (mode == ZC_MODE_MSG && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == -1)
+    {
+        perror("setsockopt SO_ZEROCOPY (falling back to copy)");
+        s->mode = ZC_MODE_COPY;
+    }
+}
+
+int zc_reap(zc_sender_t *s)
+{
+    int reaped = 0;
+    while (s->done_id != s->next_id)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof control};
+        if (recvmsg(s->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            // Only IP(V6)_RECVERR carries a completion; skip anything else queued
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) ||
+                cm->cmsg_len < CMSG_LEN(sizeof(struct sock_extended_err)))
+                continue;
+            struct sock_extended_err ee;
+            memcpy(&ee, CMSG_DATA(cm), sizeof ee);
+            if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // [ee_info, ee_data] is an inclusive range of send ids
+            uint64_t bytes = 0;
+            for (uint32_t id = ee.ee_info; id != ee.ee_data + 1; id++)
+                bytes += s->len[id % ZC_RING];
+            if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                s->stats.copied_bytes += bytes;
+            else
+                s->stats.zerocopy_bytes += bytes;
+            s->done_id = ee.ee_data + 1;
+            reaped++;
+        }
+    }
+    return reaped;
+}
+
+static ssize_t zc_send_msg(zc_sender_t *s, int flags)
+{
+    if (s->next_id - s->done_id >= ZC_RING)
+    {
+        zc_reap(s);
+        if (s->next_id - s->done_id >= ZC_RING)
+        {
+            // Completions are signalled as POLLERR
+            struct pollfd pfd = {.fd = s->fd};
+            poll(&pfd, 1, ZC_FULL_WAIT_MS);
+            zc_reap(s);
+        }
+        if (s->next_id - s->done_id >= ZC_RING)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    const char *buf = zc_payload + s->buf_off;
+    ssize_t n = send(s->fd, buf, zc_len, flags | MSG_ZEROCOPY);
+    if (n == -1 && errno == ENOBUFS)
+    {
+        // Out of option memory for notifications: reap, then copy this chunk if still short
+        zc_reap(s);
+        n = send(s->fd, buf, zc_len, flags | MSG_ZEROCOPY);
+        if (n == -1 && errno == ENOBUFS)
+        {
+            n = send(s->fd, buf, zc_len, flags);
+            if (n > 0)
+            {
+                s->stats.copied_bytes += n;
+                s->buf_off = payload_advance(s->buf_off, n);
+            }
+            return n;
+        }
+    }
+    if (n > 0)
+    {
+        s->len[s->next_id++ % ZC_RING] = (uint32_t)n;
+        s->buf_off = payload_advance(s->buf_off, n);
+    }
+    return n;
+}
+
+ssize_t zc_send(zc_sender_t *s, int flags)
+{
+    ssize_t n;
+    switch (s->mode)
+    {
+    case ZC_MODE_MSG:
+        return zc_send_msg(s, flags);
+
+    case ZC_MODE_SENDFILE:
+        if (s->file_off >= zc_file_len)
+            s->file_off = 0;
+        n = sendfile(s->fd, zc_memfd, &s->file_off, zc_len);
+        if (n > 0)
+            s->stats.zerocopy_bytes += n;
+        return n;
+
+    default:
+        n = send(s->fd, zc_payload + s->buf_off, zc_len, flags);
+        if (n > 0)
+        {
+            s->stats.copied_bytes += n;
+            s->buf_off = payload_advance(s->buf_off, n);
+        }
+        return n;
+    }
+}
+
+void zc_sender_finish(zc_sender_t *s, int wait_ms)
+{
+    if (s->mode == ZC_MODE_MSG)
+    {
+        struct timespec t0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        zc_reap(s);
+        while (s->done_id != s->next_id)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int left = wait_ms - (int)((now.tv_sec - t0.tv_sec) * 1000 + (now.tv_nsec - t0.tv_nsec) / 1000000);
+            if (left <= 0)
+                break;
+            struct pollfd pfd = {.fd = s->fd};
+            if (poll(&pfd, 1, left) <= 0)
+                break;
+            if (zc_reap(s) == 0)
+                break; // POLLERR without notifications: the socket itself failed
+        }
+        for (uint32_t id = s->done_id; id != s->next_id; id++)
+            s->stats.unconfirmed_bytes += s->len[id % ZC_RING];
+        s->done_id = s->next_id;
+    }
+
+    __atomic_fetch_add(&zc_totals.zerocopy_bytes, s->stats.zerocopy_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&zc_totals.copied_bytes, s->stats.copied_bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&zc_totals.unconfirmed_bytes, s->stats.unconfirmed_bytes, __ATOMIC_RELAXED);
+}
+
+void zc_get_stats(zc_stats_t *stats)
+{
+    stats->zerocopy_bytes = __atomic_load_n(&zc_totals.zerocopy_bytes, __ATOMIC_RELAXED);
+    stats->copied_bytes = __atomic_load_n(&zc_totals.copied_bytes, __ATOMIC_RELAXED);
+    stats->unconfirmed_bytes = __atomic_load_n(&zc_totals.unconfirmed_bytes, __ATOMIC_RELAXED);
+}
+
+void zc_print_stats(const zc_stats_t *s, const char *what)
+{
+    zc_stats_t totals;
+    if (!s)
+    {
+        zc_get_stats(&totals);
+        s = &totals;
+    }
+    printf("%s: %.1f MB zero-copy, %.1f MB copied, %.1f MB unconfirmed\n", what,
+           s->zerocopy_bytes / 1e6, s->copied_bytes / 1e6, s->unconfirmed_bytes / 1e6);
+}
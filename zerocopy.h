@@ -0,0 +1,94 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Payload send modes (server and client -z)
+#define ZC_MODE_COPY 0     // send() copies the payload into the socket buffer
+#define ZC_MODE_MSG 1      // send(MSG_ZEROCOPY): the kernel pins the payload pages
+#define ZC_MODE_SENDFILE 2 // sendfile() from a memfd: page-cache pages are referenced
+
+#define ZC_RING 1024 // MSG_ZEROCOPY sends that may await completion per socket
+
+typedef struct zc_stats
+{
+    uint64_t zerocopy_bytes;    // sent without copying the payload
+    uint64_t copied_bytes;      // copied by send() or by the kernel fallback
+    uint64_t unconfirmed_bytes; // MSG_ZEROCOPY sends still unacknowledged at close
+} zc_stats_t;
+
+// Per-socket sender state
+typedef struct zc_sender
+{
+    int fd;
+    int mode;
+    off_t file_off;             // ZC_MODE_SENDFILE: offset in the memfd
+    size_t buf_off;             // other modes: offset of the next send in the payload
+    uint32_t next_id, done_id;  // ZC_MODE_MSG: notification ids sent / reaped
+    uint32_t len[ZC_RING];      // ZC_MODE_MSG: bytes of each unreaped send
+    zc_stats_t stats;
+} zc_sender_t;
+
+/**
+ * @brief Prepares the shared payload for the given mode.
+ *
+ * Must be called before any sender is created; the payload is set up by the
+ * first call only (later calls just validate mode). It is the process-wide
+ * one of payload.h, set up here with PAYLOAD bytes per send unless
+ * payload_init() was called first. The payload is never written after
+ * this, so MSG_ZEROCOPY sends may reuse it without waiting for their
+ * completions.
+ *
+ * @param mode One of ZC_MODE_*.
+ * @return int The mode that will be used (ZC_MODE_COPY if the requested one
+ *         cannot be set up), or -1 on error.
+ */
+int zc_init(int mode);
+
+// Name of a mode for logs; parses one with zc_mode_parse (-1 if unknown)
+const char *zc_mode_name(int mode);
+int zc_mode_parse(const char *name);
+
+/**
+ * @brief Attaches a sender to a connected socket.
+ *
+ * For ZC_MODE_MSG enables SO_ZEROCOPY on fd; if the kernel refuses it the
+ * sender falls back to ZC_MODE_COPY.
+ */
+void zc_sender_init(zc_sender_t *s, int fd, int mode);
+
+/**
+ * @brief Sends up to one payload_send_size() of data.
+ *
+ * Works on blocking and non-blocking sockets. In ZC_MODE_MSG completions are
+ * reaped first when the socket has ZC_RING of them outstanding or runs out of
+ * option memory (ENOBUFS).
+ *
+ * @return ssize_t Bytes sent, or -1 with errno set as by send().
+ */
+ssize_t zc_send(zc_sender_t *s, int flags);
+
+/**
+ * @brief Drains the MSG_ZEROCOPY completions queued on the socket error queue.
+ *
+ * Each completed range is accounted as zero-copy or, when the kernel had to
+ * copy (SO_EE_CODE_ZEROCOPY_COPIED, e.g. loopback), as copied.
+ *
+ * @return int Completions reaped.
+ */
+int zc_reap(zc_sender_t *s);
+
+/**
+ * @brief Waits up to wait_ms for outstanding completions and publishes the
+ *        sender counters to the process totals.
+ */
+void zc_sender_finish(zc_sender_t *s, int wait_ms);
+
+// Process-wide totals of every finished sender
+void zc_get_stats(zc_stats_t *stats);
+
+// Prints s (or the totals if s is NULL) on one line, prefixed by what
+void zc_print_stats(const zc_stats_t *s, const char *what);
+
+#endif // ZEROCOPY_H